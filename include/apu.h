@@ -1,8 +1,62 @@
 #pragma once
 #include "common.h"
+#include "psg.h"
+
+#define APU_SAMPLE_RATE 32768
+#define APU_CYCLES_PER_SAMPLE 512
+
+// Stereo frames held between the core and the frontend; a power of two.
+#define APU_BUFFER_SIZE 4096
+
+#define FIFO_SIZE 32
+
+typedef struct {
+  s8 data[FIFO_SIZE];
+  int read;
+  int write;
+  int count;
+
+  s8 sample; // currently playing sample
+} Fifo;
 
 typedef struct {
+  u16 soundcnt_h;
+  u8 soundcnt_x;
   u16 soundbias;
+
+  struct {
+    bool enable_right;
+    bool enable_left;
+    int timer;
+    int volume; // shift applied to the 8-bit sample
+  } dsound[2];
+
+  bool master_enable;
+
+  Fifo fifo[2];
+
+  Psg psg;
+
+  uint next_sample_time;
 } Apu;
 
+// Output samples waiting for the frontend. Written only by the emulation
+// thread and kept host-side in Gba, since they're output, not state.
+typedef struct {
+  s16 data[APU_BUFFER_SIZE][2];
+  u32 read;
+  u32 write;
+} ApuBuffer;
+
 void apu_init(Apu *apu);
+void apu_set_synthesize(Gba *gba, bool enable);
+
+void apu_sync(Gba *gba);
+int apu_read_samples(Gba *gba, s16 *dest, int frames);
+
+void apu_soundcnt_h_write(Gba *gba, u16 val);
+void apu_soundcnt_x_write(Gba *gba, u8 val);
+void apu_fifo_write(Gba *gba, int fifo, u8 val);
+
+bool apu_timer_in_use(Apu *apu, int tmr);
+void apu_on_timer_overflow(Gba *gba, int tmr);
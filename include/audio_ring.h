@@ -0,0 +1,22 @@
+#pragma once
+#include "common.h"
+#include <stdatomic.h>
+
+// Lock-free single-producer/single-consumer ring of stereo s16 frames. The
+// emulation thread writes, the audio callback reads; neither ever blocks.
+typedef struct {
+  s16 *data;
+  u32 size; // frames, a power of two
+
+  _Alignas(64) _Atomic u32 write;
+  _Alignas(64) _Atomic u32 read;
+} AudioRing;
+
+bool audio_ring_init(AudioRing *ring, u32 min_frames);
+void audio_ring_free(AudioRing *ring);
+
+u32 audio_ring_fill(AudioRing *ring);
+
+// Both return the number of frames actually transferred.
+u32 audio_ring_write(AudioRing *ring, const s16 *src, u32 frames);
+u32 audio_ring_read(AudioRing *ring, s16 *dest, u32 frames);
@@ -9,17 +9,77 @@ typedef enum {
   BACKUP_FLASH128
 } BackupType;
 
+#define BACKUP_MAX_SIZE (128 * 1024)
+
+// Flash takes commands as byte writes prefixed by AA to 5555 and 55 to 2AAA.
+typedef enum {
+  FLASH_READY,
+  FLASH_CMD1, // got AA
+  FLASH_CMD2, // got AA 55, next write is the command
+  FLASH_ERASE, // erase armed, waiting for AA 55 and what to erase
+  FLASH_ERASE_CMD1,
+  FLASH_ERASE_CMD2,
+  FLASH_WRITE, // next write stores one byte
+  FLASH_BANK   // next write to 0000 selects the bank
+} FlashState;
+
+// EEPROM is a serial device, one bit per 16-bit access, always moved by
+// DMA 3. Requests are "11" + address + "0" to read and "10" + address +
+// 64 data bits + "0" to write. A read answers with 4 junk bits then 64
+// data bits, most significant first.
+typedef enum {
+  EEPROM_COMMAND,
+  EEPROM_READ_ADDRESS,
+  EEPROM_READ_END,
+  EEPROM_READ_DATA,
+  EEPROM_WRITE_ADDRESS,
+  EEPROM_WRITE_DATA,
+  EEPROM_WRITE_END
+} EepromState;
+
+// Save bytes changed since the frontend last took them, [start, end).
+// Host-side, next to the DirtyMap, so restoring a state can't lose them.
+typedef struct {
+  u32 start;
+  u32 end;
+} BackupRange;
+
 typedef struct {
   BackupType type;
-  u8 *data;
   u32 size;
+
+  FlashState flash_state;
+  bool flash_id_mode;
+  u8 flash_bank;
+
+  EepromState eeprom_state;
+  int eeprom_address_bits; // 6 for 512 bytes, 14 for 8K; 0 until known
+  int eeprom_bit_count;
+  u32 eeprom_address;
+  u64 eeprom_buffer;
+
+  u8 data[BACKUP_MAX_SIZE];
 } Backup;
 
-void backup_init(Backup *backup, u8 *rom_data, u32 rom_size);
+void backup_init(Backup *backup, BackupType type);
 u8 backup_read8(Backup *backup, u32 address);
 u16 backup_read16(Backup *backup, u32 address);
 u32 backup_read32(Backup *backup, u32 address);
 
-void backup_write8(Backup *backup, u32 address, u8 val);
-void backup_write16(Backup *backup, u32 address, u16 val);
-void backup_write32(Backup *backup, u32 address, u32 val);
+// Writes also add the bytes they change to `unsaved` and mark their pages
+// in `dirty`.
+void backup_write8(Backup *backup, BackupRange *unsaved, DirtyMap *dirty,
+                   u32 address, u8 val);
+void backup_write16(Backup *backup, BackupRange *unsaved, DirtyMap *dirty,
+                    u32 address, u16 val);
+void backup_write32(Backup *backup, BackupRange *unsaved, DirtyMap *dirty,
+                    u32 address, u32 val);
+
+u16 backup_eeprom_read(Backup *backup);
+void backup_eeprom_write(Backup *backup, BackupRange *unsaved,
+                         DirtyMap *dirty, u16 val);
+// DMA 3 word counts give the address width away: 9 or 73 for 6 bits, 17
+// or 81 for 14 bits.
+void backup_eeprom_detect(Backup *backup, u32 count);
+
+void backup_range_add(BackupRange *range, u32 start, u32 end);
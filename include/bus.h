@@ -31,6 +31,7 @@ struct Bus {
 void bus_init(Bus *bus);
 
 int get_region(u32 address);
+bool bus_is_eeprom(Gba *gba, u32 address);
 
 u8 bus_read8(Gba *gba, u32 address, Access access);
 void bus_write8(Gba *gba, u32 address, u8 value, Access access);
@@ -0,0 +1,59 @@
+#pragma once
+#include "common.h"
+#include <pthread.h>
+
+// Durable checkpoints of a long run, appended to one file. Each checkpoint
+// holds only what changed since the previous one, as reported by the dirty
+// map, and every `full_interval`th holds the whole state so a restore
+// replays a bounded number of deltas. Once the file grows past `max_bytes`
+// it is compacted at the next full checkpoint, dropping everything before.
+//
+//   header: "GBACHKPT", u32 version, u32 state size, u32 ROM CRC-32
+//   record: u32 type, u32 sequence, u64 tag, u32 size, u32 compressed
+//           size, u32 CRC-32 of the fields before it and the data, data
+//
+// A delta is a list of u32 offset, u32 size and the bytes at that offset
+// in the state; both kinds are LZ-compressed. Records are written and
+// synced on a worker, so capturing only costs copying the changed ranges.
+// A record torn by a crash fails its CRC and ends the file.
+//
+// The checkpointer owns the instance's dirty map while it is open.
+typedef struct {
+  char path[4096];
+  FILE *file;
+  u64 file_size;
+  u32 rom_crc;
+
+  int interval; // frames between checkpoints
+  int counter;
+  int full_interval;
+  int since_full;
+  u64 max_bytes; // 0 to never compact
+  u32 sequence;
+
+  u8 *staging; // changed ranges, handed to the worker
+  size_t staging_size;
+  u64 staging_tag;
+  u8 *mirror;     // the state as of the last checkpoint
+  u8 *compressed; // record payload
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool pending;
+  bool quit;
+} Checkpoint;
+
+bool checkpoint_open(Checkpoint *ck, Gba *gba, const char *path, int interval,
+                     int full_interval, u64 max_bytes);
+// Writes out the checkpoint still in flight, then closes the file.
+void checkpoint_close(Checkpoint *ck);
+
+// Call once per frame. Every `interval` frames the changed ranges are
+// copied for the worker, labelled with `tag`, e.g. the frame number; if it
+// is still busy the checkpoint is taken on a later frame instead.
+void checkpoint_capture(Checkpoint *ck, Gba *gba, u64 tag);
+
+// Restores checkpoint `sequence`, or the newest one if negative. `tag`
+// receives its label if not NULL.
+bool checkpoint_restore(Gba *gba, const char *path, s64 sequence, u64 *tag);
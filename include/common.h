@@ -19,6 +19,7 @@ typedef struct Bus Bus;
 typedef struct Cpu Cpu;
 typedef struct Ppu Ppu;
 typedef struct Keypad Keypad;
+typedef struct DirtyMap DirtyMap;
 
 #define SCALE 4
 #define SCREEN_WIDTH 240 * SCALE
@@ -34,6 +35,25 @@ typedef struct Keypad Keypad;
 #define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
 #define MAX(X, Y) ((X) > (Y) ? (X) : (Y))
 
+// Little-endian fields of the file formats, independent of host order.
+static inline void put16(u8 *p, u16 v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static inline void put32(u8 *p, u32 v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static inline u16 get16(const u8 *p) { return p[0] | (p[1] << 8); }
+
+static inline u32 get32(const u8 *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
 #define NOT_YET_IMPLEMENTED(str)                                               \
   printf("%s not yet implemented: %s:%d\n", str, __FILE__, __LINE__);          \
   exit(1);
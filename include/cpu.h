@@ -7,7 +7,7 @@
 #define LR (gba->cpu.r14)
 #define SP (gba->cpu.r13)
 #define CPSR (gba->cpu.cpsr)
-#define SPSR (*(gba->cpu.spsr))
+#define SPSR (*cpu_spsr(&gba->cpu))
 
 // Condition Flags
 #define CPSR_N (BIT(31)) // Negative
@@ -63,7 +63,7 @@ struct Cpu {
   u32 regs_und[2];    // R13_und - R14_und
 
   u32 cpsr; // Current Program Status Register
-  u32 *spsr;
+  u32 spsr_offset; // offsetof(Cpu, spsr_<mode>), or cpsr in USR/SYS mode
   u32 spsr_fiq;
   u32 spsr_svc;
   u32 spsr_irq;
@@ -75,7 +75,13 @@ struct Cpu {
   u32 pipeline[2]; // Instruction pipeline
 };
 
+// The current SPSR is kept as an offset so the CPU state holds no pointers.
+static inline u32 *cpu_spsr(Cpu *cpu) {
+  return (u32 *)((u8 *)cpu + cpu->spsr_offset);
+}
+
 void cpu_init(Cpu *cpu);
+void cpu_skip_bios(Cpu *cpu);
 void cpu_set_mode(Cpu *cpu, u32 new_mode);
 
 void cpu_step(Gba *gba);
@@ -0,0 +1,6 @@
+#pragma once
+#include "common.h"
+
+// CRC-32 (IEEE 802.3), as used by zip and most ROM databases. Pass 0 to
+// start and the previous result to continue over more data.
+u32 crc32(u32 crc, const u8 *data, size_t size);
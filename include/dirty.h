@@ -0,0 +1,64 @@
+#pragma once
+#include "backup.h"
+#include "common.h"
+
+// One bit per 256-byte page of the memories the bus writes to, set on every
+// write and cleared by whoever consumes it. It tells snapshots, caches and
+// state sync what changed without comparing memory.
+#define DIRTY_PAGE_SHIFT 8
+#define DIRTY_PAGE_SIZE (1 << DIRTY_PAGE_SHIFT)
+
+typedef enum {
+  DIRTY_EWRAM,
+  DIRTY_IWRAM,
+  DIRTY_PALETTE,
+  DIRTY_VRAM,
+  DIRTY_OAM,
+  DIRTY_BACKUP,
+  DIRTY_NUM_REGIONS
+} DirtyRegion;
+
+#define DIRTY_EWRAM_PAGES (0x40000 >> DIRTY_PAGE_SHIFT)
+#define DIRTY_IWRAM_PAGES (0x8000 >> DIRTY_PAGE_SHIFT)
+#define DIRTY_PALETTE_PAGES (0x400 >> DIRTY_PAGE_SHIFT)
+#define DIRTY_VRAM_PAGES (0x18000 >> DIRTY_PAGE_SHIFT)
+#define DIRTY_OAM_PAGES (0x400 >> DIRTY_PAGE_SHIFT)
+#define DIRTY_BACKUP_PAGES (BACKUP_MAX_SIZE >> DIRTY_PAGE_SHIFT)
+
+// First page of each region in the bitmap, then the total.
+#define DIRTY_IWRAM_BASE DIRTY_EWRAM_PAGES
+#define DIRTY_PALETTE_BASE (DIRTY_IWRAM_BASE + DIRTY_IWRAM_PAGES)
+#define DIRTY_VRAM_BASE (DIRTY_PALETTE_BASE + DIRTY_PALETTE_PAGES)
+#define DIRTY_OAM_BASE (DIRTY_VRAM_BASE + DIRTY_VRAM_PAGES)
+#define DIRTY_BACKUP_BASE (DIRTY_OAM_BASE + DIRTY_OAM_PAGES)
+#define DIRTY_PAGES (DIRTY_BACKUP_BASE + DIRTY_BACKUP_PAGES)
+
+static const u32 dirty_region_base[DIRTY_NUM_REGIONS + 1] = {
+    0,
+    DIRTY_IWRAM_BASE,
+    DIRTY_PALETTE_BASE,
+    DIRTY_VRAM_BASE,
+    DIRTY_OAM_BASE,
+    DIRTY_BACKUP_BASE,
+    DIRTY_PAGES,
+};
+
+struct DirtyMap {
+  u64 bits[(DIRTY_PAGES + 63) / 64];
+};
+
+static inline void dirty_mark(DirtyMap *map, DirtyRegion region, u32 offset) {
+  u32 page = dirty_region_base[region] + (offset >> DIRTY_PAGE_SHIFT);
+  map->bits[page / 64] |= 1ull << (page % 64);
+}
+
+// Marks the pages overlapping [start, end).
+void dirty_mark_range(DirtyMap *map, DirtyRegion region, u32 start, u32 end);
+void dirty_mark_all(DirtyMap *map);
+void dirty_clear(DirtyMap *map);
+
+u32 dirty_region_pages(DirtyRegion region);
+bool dirty_test(const DirtyMap *map, DirtyRegion region, u32 page);
+// The first dirty page of the region at or after `page`, or -1.
+int dirty_next(const DirtyMap *map, DirtyRegion region, u32 page);
+u32 dirty_count(const DirtyMap *map, DirtyRegion region);
@@ -64,3 +64,4 @@ void dma_control_write(Gba *gba, int ch, u16 val);
 
 void dma_on_vblank(Gba *gba);
 void dma_on_hblank(Gba *gba);
+void dma_on_fifo(Gba *gba, int fifo);
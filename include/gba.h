@@ -4,6 +4,7 @@
 #include "bus.h"
 #include "common.h"
 #include "cpu.h"
+#include "dirty.h"
 #include "dma.h"
 #include "interrupt.h"
 #include "io.h"
@@ -12,12 +13,15 @@
 #include "rom.h"
 #include "scheduler.h"
 #include "timer.h"
+#include <stddef.h>
 
+// Everything up to `rom` is machine state: it holds no pointers, so a whole
+// instance can be snapshotted, restored or cloned with one memcpy of
+// GBA_STATE_SIZE bytes. The fields after it are host-side and stay with
+// the instance.
 struct Gba {
   u8 bios[0x4000];
 
-  Rom rom;
-
   Cpu cpu;
 
   Bus bus;
@@ -44,10 +48,57 @@ struct Gba {
   Backup backup;
 
   Keypad keypad;
+
+  // Cycles the frames so far ran past their nominal length.
+  int frame_overshoot;
+
+  Rom rom;
+
+  // Frontend buffer scanlines are written to, or NULL for ppu.framebuffer.
+  void *video_output;
+  int video_pitch;
+  PixelFormat video_format;
+  // BG palette converted to video_format for the mode 4 direct path;
+  // rebuilt lazily after palette writes and restores.
+  u32 palette_cache[256];
+  bool palette_dirty;
+  // Scanlines aren't rendered at all, for frames nobody will see.
+  bool skip_video;
+  // Samples are generated; see apu_set_synthesize.
+  bool synthesize;
+  // Samples produced but not yet read by the frontend.
+  ApuBuffer audio;
+  // Save bytes the save file hasn't taken yet. A restore marks all of them,
+  // since the save has to follow the cartridge back.
+  BackupRange unsaved;
+  // Pages written since its owner last cleared it. Kept out of the state
+  // so restoring a snapshot can't make pages look clean.
+  DirtyMap dirty;
 };
 
+#define GBA_STATE_SIZE offsetof(Gba, rom)
+
 bool gba_init(Gba *gba, const char *bios_path, const char *rom_path);
+void gba_init_shared(Gba *gba, const u8 *bios, const Rom *rom);
+
+void gba_skip_bios(Gba *gba);
 
 void gba_free(Gba *gba);
 
+void gba_run_frame(Gba *gba);
+bool gba_run_to_pc(Gba *gba, u32 pc, int max_frames);
+
+void gba_snapshot(Gba *gba, void *state);
+size_t gba_snapshot_incremental(Gba *gba, void *state);
+
+// Calls `fn` with every byte range of the state that may have changed since
+// the dirty map was last cleared: the untracked parts whole, and the dirty
+// pages of the tracked memories. Doesn't clear the map.
+typedef void (*GbaRangeFn)(void *ctx, size_t offset, size_t size);
+void gba_changed_ranges(Gba *gba, GbaRangeFn fn, void *ctx);
+void gba_restore(Gba *gba, const void *state);
+void gba_clone(Gba *dest, Gba *src);
+
+void gba_run_ahead(Gba *gba, int frames, void *scratch);
+
 bool load_bios(u8 *bios, const char *bios_path);
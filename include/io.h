@@ -10,6 +10,7 @@ typedef enum {
 typedef struct {
   u16 keycnt;
   u16 waitcnt;
+  u8 postflg;
   PowerState power_state;
 } Io;
 
@@ -117,6 +118,7 @@ void io_write32(Gba *gba, u32 addr, u32 val);
 #define IME 0x04000208
 
 #define WAITCNT 0x04000204
+#define POSTFLG 0x04000300
 #define HALTCNT 0x04000301
 
 // DMA
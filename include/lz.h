@@ -0,0 +1,14 @@
+#pragma once
+#include "common.h"
+
+// Byte-oriented LZ77 in the style of LZ4: no entropy coding, so both
+// directions run at memory speed. Used for save states.
+
+// Worst-case compressed size of `size` input bytes.
+#define LZ_BOUND(size) ((size) + (size) / 255 + 16)
+
+size_t lz_compress(const u8 *src, size_t size, u8 *dest);
+
+// Returns false if the input is malformed or doesn't decode to exactly
+// `dest_size` bytes.
+bool lz_decompress(const u8 *src, size_t size, u8 *dest, size_t dest_size);
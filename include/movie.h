@@ -0,0 +1,53 @@
+#pragma once
+#include "common.h"
+
+// Input movies replay a recorded session exactly: the save state it started
+// from plus the frames on which KEYINPUT changed. Everything else is
+// deterministic, so a movie reproduces the same frames on every run.
+//
+//   header: "GBAMOVIE", u32 version, u32 ROM CRC-32, u32 BIOS CRC-32,
+//           u32 frame count, u32 event count, u32 state size
+//   state:  a save state (see savestate.h)
+//   events: u32 frame, u16 keyinput
+//
+// All fields are little-endian.
+#define MOVIE_VERSION 1
+
+typedef struct {
+  u32 frame;
+  u16 keyinput;
+} MovieEvent;
+
+typedef struct {
+  u32 rom_crc;
+  u32 bios_crc;
+
+  u8 *state;
+  u32 state_size;
+
+  MovieEvent *events;
+  u32 event_count;
+  u32 event_capacity;
+
+  u32 frame_count; // frames recorded, or in the loaded movie
+  u32 frame;       // playback position
+  u32 cursor;      // next event to apply
+  u16 keyinput;    // as of the last recorded frame
+} Movie;
+
+// Starts a movie from the current state of `gba`.
+bool movie_record_start(Movie *movie, Gba *gba);
+// Call before running each recorded frame.
+void movie_record_frame(Movie *movie, Gba *gba);
+
+// Restores the movie's initial state. Fails if it was recorded with a
+// different ROM or BIOS.
+bool movie_play_start(Movie *movie, Gba *gba);
+// Call before running each frame; sets its input. Returns false once the
+// movie has ended.
+bool movie_play_frame(Movie *movie, Gba *gba);
+
+bool movie_save(Movie *movie, const char *path);
+bool movie_load(Movie *movie, const char *path);
+
+void movie_free(Movie *movie);
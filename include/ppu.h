@@ -18,6 +18,12 @@
 #define H_VISIBLE_CYCLES 960
 #define H_BLANK_CYCLES 272
 
+typedef enum {
+  PIXEL_FORMAT_ARGB8888,
+  PIXEL_FORMAT_RGB565,
+  PIXEL_FORMAT_BGR555,
+} PixelFormat;
+
 typedef enum {
   NONE,
   ALPHA,
@@ -27,6 +33,7 @@ typedef enum {
 
 struct Ppu {
   u32 framebuffer[PIXELS_WIDTH * PIXELS_HEIGHT];
+
   int cycle;
 
   u8 palram[0x400];
@@ -159,6 +166,10 @@ typedef struct {
 typedef enum { OBJMODE_REG, OBJMODE_AFF, OBJMODE_HIDE, OBJMODE_AFFDBL } ObjMode;
 
 void ppu_init(Ppu *ppu);
+void ppu_set_output(Gba *gba, void *buffer, int pitch);
+void ppu_set_skip_video(Gba *gba, bool skip);
+void ppu_set_format(Gba *gba, PixelFormat format);
+int ppu_bytes_per_pixel(PixelFormat format);
 
 void ppu_hblank_start(Gba *gba, uint lateness);
 void ppu_hblank_end(Gba *gba, uint lateness);
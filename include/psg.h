@@ -0,0 +1,110 @@
+#pragma once
+#include "common.h"
+
+// Frame sequencer period: 512 Hz.
+#define PSG_SEQUENCER_CYCLES 32768
+
+// Channel outputs are not stepped; they are evaluated at each output sample
+// time from the time the channel was last (re)started and its step period.
+// Only the LFSR is advanced, by the number of steps since it was last read.
+typedef struct {
+  bool enable;
+  bool dac_enable;
+
+  int length;
+  bool length_enable;
+
+  int volume;
+  int initial_volume;
+  int env_period;
+  bool env_increase;
+  int env_timer;
+
+  int freq;
+  int duty;
+
+  uint start_time;
+  u32 phase_base;
+
+  // Sweep (channel 1 only)
+  int sweep_shift;
+  bool sweep_decrease;
+  int sweep_period;
+  int sweep_timer;
+  bool sweep_enable;
+  int shadow_freq;
+} SquareChannel;
+
+typedef struct {
+  bool enable;
+  bool dac_enable;
+
+  int length;
+  bool length_enable;
+
+  int volume;
+  bool force_volume;
+
+  bool dimension; // 64 samples across both banks
+  int bank;
+
+  int freq;
+
+  uint start_time;
+  u32 phase_base;
+
+  u8 ram[2][16];
+} WaveChannel;
+
+typedef struct {
+  bool enable;
+  bool dac_enable;
+
+  int length;
+  bool length_enable;
+
+  int volume;
+  int initial_volume;
+  int env_period;
+  bool env_increase;
+  int env_timer;
+
+  int divider;
+  bool width_7;
+  int shift;
+
+  u16 lfsr;
+  bool output;
+  uint start_time;
+  u32 steps;
+} NoiseChannel;
+
+typedef struct {
+  u8 regs[0x22]; // SOUND1CNT_L .. SOUNDCNT_L as last written
+
+  SquareChannel square[2];
+  WaveChannel wave;
+  NoiseChannel noise;
+
+  int volume_right;
+  int volume_left;
+  int enable_right[4];
+  int enable_left[4];
+
+  bool sequencer_running;
+  int sequencer_step;
+} Psg;
+
+void psg_init(Psg *psg);
+
+u8 psg_read8(Gba *gba, u32 addr);
+void psg_write8(Gba *gba, u32 addr, u8 val);
+
+u8 psg_wave_read8(Gba *gba, u32 addr);
+void psg_wave_write8(Gba *gba, u32 addr, u8 val);
+
+u8 psg_status(Psg *psg);
+void psg_disable(Gba *gba);
+
+void psg_sample(Psg *psg, uint time, int *left, int *right);
+void psg_sequencer_step(Gba *gba, uint lateness);
@@ -0,0 +1,33 @@
+#pragma once
+#include "common.h"
+
+// Polyphase windowed-sinc resampler for interleaved stereo s16 audio.
+#define RESAMPLER_TAPS 32
+#define RESAMPLER_PHASES 256 // indexed by the top 8 bits of the fraction
+
+// Input frames buffered per call; larger inputs are processed in chunks.
+#define RESAMPLER_CHUNK 2048
+
+typedef struct {
+  _Alignas(32) float kernel[RESAMPLER_PHASES + 1][RESAMPLER_TAPS];
+
+  // Planar history: the last TAPS - 1 frames of the previous call, then the
+  // current input.
+  _Alignas(32) float history[2][RESAMPLER_CHUNK + RESAMPLER_TAPS];
+  int history_len;
+
+  double base_ratio; // input frames per output frame
+  u64 step;          // 32.32 fixed point, base_ratio * adjustment
+  u64 pos;           // 32.32 fixed point offset into history
+} Resampler;
+
+void resampler_init(Resampler *rs, int in_rate, int out_rate);
+
+// Scales the conversion ratio by `adjust` (e.g. 1.002 to produce 0.2% fewer
+// output frames) without rebuilding the kernel or disturbing the phase.
+void resampler_set_adjust(Resampler *rs, double adjust);
+
+// Upper bound on the output frames produced for `in_frames` input frames.
+int resampler_max_output(Resampler *rs, int in_frames);
+
+int resampler_process(Resampler *rs, const s16 *in, int in_frames, s16 *out);
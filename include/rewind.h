@@ -0,0 +1,55 @@
+#pragma once
+#include "common.h"
+#include <pthread.h>
+
+// Rewind history kept as a chain of XOR deltas. Only the newest snapshot is
+// held in full; each delta turns it into the one captured before it. Deltas
+// are run-length coded, so the parts of the state a frame didn't touch cost
+// next to nothing, and the oldest are dropped once the budget is reached.
+//
+// Encoding runs on a worker thread: rewind_capture only copies the state
+// into a staging buffer and hands it over.
+typedef struct {
+  u8 *data;
+  u32 size;
+} RewindDelta;
+
+typedef struct {
+  int interval; // frames between captures
+  int counter;
+
+  size_t budget; // bytes of delta data kept
+  size_t used;
+
+  RewindDelta *deltas; // ring, oldest at `head`
+  u32 capacity;
+  u32 head;
+  u32 count;
+
+  u8 *staging;  // handed from the emulation thread to the worker
+  u8 *current;  // newest snapshot, base of the next delta
+  u8 *scratch;  // encoder output
+  bool has_current;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool pending;
+  bool quit;
+} Rewind;
+
+bool rewind_init(Rewind *rw, int interval, size_t budget);
+void rewind_free(Rewind *rw);
+
+// Call once per frame. Every `interval` frames the state is copied for the
+// worker; if it is still busy with the previous one the capture is skipped.
+void rewind_capture(Rewind *rw, Gba *gba);
+
+// Restores the snapshot before the newest one and makes it the newest.
+// Returns false once the history is exhausted.
+bool rewind_step(Rewind *rw, Gba *gba);
+
+// Waits for the worker and drops all history.
+void rewind_reset(Rewind *rw);
+
+u32 rewind_count(Rewind *rw);
@@ -1,13 +1,19 @@
 #include "common.h"
+#include "rominfo.h"
 
 #define ROM_MAX_SIZE 0x2000000 // 32 MB
 
+// The cartridge ROM is read-only and lives outside the machine state.
 typedef struct {
   u8 *data;
   u32 size;
-  char *title;
-  char *code;
-  char *maker;
+  bool owned;  // false for clones sharing another instance's ROM
+  bool mapped; // mmap'd from the file rather than read into memory
+  char title[13];
+  char code[5];
+  char maker[3];
+  RomInfo info;
 } Rom;
 
 bool load_rom(Rom *rom, const char *filename);
+void free_rom(Rom *rom);
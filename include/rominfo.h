@@ -0,0 +1,31 @@
+#pragma once
+#include "backup.h"
+#include "common.h"
+
+// What is known about a game, gathered once when its ROM is loaded. The
+// ROM is scanned on first sight and the result kept in an index keyed by
+// its CRC-32, so later boots only hash it. A hand-written game database
+// can then override or add to what the scan found, e.g.:
+//
+//   # crc     settings
+//   1F1C08FB  save=flash128 idle=0x080002D4 waitcnt=0x4317
+//
+// Both live in $GBA_EMU_DIR, else $XDG_CACHE_HOME/gba-emu or
+// ~/.cache/gba-emu, as rominfo.idx and gamedb.txt.
+typedef struct {
+  u32 crc;
+  BackupType save_type;
+  u32 swi_mask;   // BIOS calls 0x00-0x1F the game has wrappers for
+  u32 idle_loop;  // address of the game's wait loop, 0 if unknown
+  u16 waitcnt;    // known-good WAITCNT, if has_waitcnt
+  bool has_waitcnt;
+} RomInfo;
+
+void rominfo_load(RomInfo *info, const u8 *rom, u32 size);
+// Whether rominfo_load applies the game database; on by default. Turned
+// off for results that mustn't depend on the user's files. Set it before
+// loading any ROM.
+void rominfo_use_database(bool use);
+
+// The scan alone, without the index or database.
+void rominfo_analyze(RomInfo *info, const u8 *rom, u32 size);
@@ -0,0 +1,31 @@
+#pragma once
+#include "common.h"
+#include <pthread.h>
+#include <time.h>
+
+// The cartridge's backup memory kept in a file, usually <rom>.sav. The file
+// is mapped shared, so once bytes are copied into the mapping the kernel
+// owns them and they outlive a crash. Writing them to disk is left to a
+// worker that waits until the game has stopped saving for a moment, so
+// the emulation thread never blocks on I/O.
+typedef struct {
+  int fd;
+  u8 *map;
+  u32 size;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool pending; // mapping changed since the last flush
+  bool quit;
+  struct timespec changed; // CLOCK_MONOTONIC
+} SaveFile;
+
+// Loads the file into the backup memory, creating it if needed. Returns
+// false if the game has no backup memory or the file can't be used.
+bool savefile_open(SaveFile *save, Gba *gba, const char *path);
+void savefile_close(SaveFile *save);
+
+// Call once per frame. Copies what the game wrote since the last call into
+// the mapping.
+void savefile_sync(SaveFile *save, Gba *gba);
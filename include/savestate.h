@@ -0,0 +1,22 @@
+#pragma once
+#include "common.h"
+
+// Save states are a header followed by chunks, one per component, each
+// LZ-compressed independently:
+//
+//   header: "GBASTATE", u32 version, u32 chunk count
+//   chunk:  char id[4], u32 size, u32 compressed size, data
+//
+// Chunks hold the component structs as laid out by this build, so a state
+// only loads into a build with the same SAVESTATE_VERSION and struct sizes.
+// Unknown chunks are skipped.
+#define SAVESTATE_VERSION 8
+
+// Upper bound on the serialized size of a state.
+size_t savestate_bound(void);
+
+size_t savestate_save(Gba *gba, u8 *buf);
+bool savestate_load(Gba *gba, const u8 *buf, size_t size);
+
+bool gba_save_state(Gba *gba, const char *path);
+bool gba_load_state(Gba *gba, const char *path);
@@ -10,17 +10,30 @@ typedef enum {
   EVENT_TYPE_TIMER_OVERFLOW,
   EVENT_TYPE_DMA_ACTIVATE,
   EVENT_TYPE_IRQ,
+  EVENT_TYPE_APU_SEQUENCER,
 } EventType;
 
-typedef struct Event {
+// Upper bound on pending events. Frame end, the PPU's scanline event, the
+// APU sequencer and each timer and DMA channel are pending at most once.
+// IRQ events aren't merged, but they are due as soon as they're pushed, so
+// only one batch piles up: one per interrupt source raised by the events
+// due at one time, plus the IE and IME byte writes of one instruction.
+// Doubled for margin; running out is a bug, not a condition to handle.
+#define SCHEDULER_SOURCE_EVENTS (1 + 1 + 1 + 4 + 4)
+#define SCHEDULER_IRQ_EVENTS (14 + 4)
+#define SCHEDULER_MAX_EVENTS (2 * (SCHEDULER_SOURCE_EVENTS + SCHEDULER_IRQ_EVENTS))
+
+typedef struct {
   EventType type;
   uint scheduled_time;
-  void *ctx;
-  struct Event *next;
+  int ctx;
 } Event;
 
+// Pending events are kept in a fixed array sorted latest first, so the next
+// event is popped from the end and the scheduler holds no pointers.
 typedef struct {
-  Event *head;
+  Event events[SCHEDULER_MAX_EVENTS];
+  int count;
   uint current_time;
 } Scheduler;
 
@@ -30,11 +43,11 @@ void scheduler_push_event(Scheduler *scheduler, EventType type,
                           uint time_from_now);
 
 void scheduler_push_event_ctx(Scheduler *scheduler, EventType type,
-                              uint time_from_now, void *ctx);
+                              uint time_from_now, int ctx);
 
-Event *scheduler_pop_event(Scheduler *scheduler);
+bool scheduler_pop_event(Scheduler *scheduler, Event *event);
 
-void scheduler_cancel_event(Scheduler *scheduler, EventType type, void *ctx);
+void scheduler_cancel_event(Scheduler *scheduler, EventType type, int ctx);
 
 uint scheduler_peek_next_event_time(Scheduler *scheduler);
 
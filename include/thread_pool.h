@@ -0,0 +1,52 @@
+#pragma once
+#include "common.h"
+#include <pthread.h>
+
+// Fixed set of worker threads with a task deque each. Workers take their own
+// newest task first and, when out of work, steal the oldest task of another
+// worker, so uneven jobs even out without a shared queue everyone contends
+// on. Tasks are meant to be coarse, like running a whole game.
+typedef void (*PoolTask)(void *arg);
+
+typedef struct {
+  PoolTask fn;
+  void *arg;
+} PoolItem;
+
+typedef struct {
+  pthread_mutex_t lock;
+  PoolItem *items; // ring
+  u32 capacity;    // a power of two
+  u32 head;        // oldest
+  u32 count;
+} PoolDeque;
+
+typedef struct ThreadPool ThreadPool;
+
+typedef struct {
+  ThreadPool *pool;
+  int index;
+  pthread_t thread;
+} PoolWorker;
+
+struct ThreadPool {
+  int num_workers;
+  PoolWorker *workers;
+  PoolDeque *deques;
+  int next; // deque the next submitted task goes to
+
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  u32 queued;  // tasks not yet taken
+  u32 pending; // tasks not yet finished
+  bool quit;
+};
+
+// `threads` <= 0 uses one per online CPU.
+bool pool_init(ThreadPool *pool, int threads);
+void pool_free(ThreadPool *pool);
+
+void pool_submit(ThreadPool *pool, PoolTask fn, void *arg);
+// Blocks until every submitted task has finished.
+void pool_wait(ThreadPool *pool);
@@ -14,6 +14,8 @@ typedef struct {
   u16 count;
   u16 reload_count;
 
+  // Time of the last tick applied to `count`. Overflows nobody observes are
+  // not scheduled; they are applied in closed form when the count is needed.
   uint start_time;
 
   TimerControl control;
@@ -26,8 +28,12 @@ typedef struct {
 void timer_init(TimerManager *tmr_mgr);
 void timer_step(Gba *gba, int cycles);
 
+void timer_reload_write(Gba *gba, int tmr, u16 val);
 void timer_control_write(Gba *gba, int tmr, u16 val);
 
+void timer_sync(Gba *gba);
+void timer_reschedule(Gba *gba);
+
 // void timer_update(Gba *gba, int tmr);
 u16 timer_get_count(Gba *gba, int tmr);
 void timer_overflow(Gba *gba, int tmr, uint lateness);
@@ -0,0 +1,67 @@
+#pragma once
+#include "common.h"
+#include "thread_pool.h"
+
+// A batch of instances stepped together for reinforcement learning. Every
+// episode starts from one snapshot, so a reset is a memcpy. A step runs
+// all instances in parallel on a thread pool and leaves its results in
+// buffers allocated once, instance i at index i:
+//
+//   observations: the last frame, rendered straight into the buffer in the
+//                 source instance's pixel format
+//   ram:          EWRAM then IWRAM, VECENV_RAM_SIZE bytes each
+//   done:         whether the episode ended with this step
+//
+// Frames before the last one of a step aren't rendered, and audio isn't
+// synthesized at all.
+
+#define VECENV_RAM_SIZE (0x40000 + 0x8000)
+
+// Decides whether an episode has ended, e.g. from a lives counter in RAM.
+// Called on pool threads, concurrently for different instances.
+typedef bool (*VecEnvDoneFn)(Gba *gba, void *ctx);
+
+typedef struct VecEnv VecEnv;
+
+typedef struct {
+  VecEnv *env;
+  int index;
+} VecEnvTask;
+
+struct VecEnv {
+  int num_envs;
+  Gba **envs;
+  VecEnvTask *tasks;
+  u8 *start; // the state every episode starts from
+
+  int max_frames; // episode length limit, 0 for none
+  VecEnvDoneFn done_fn;
+  void *done_ctx;
+
+  u8 *observations;
+  size_t observation_size; // bytes per instance
+  u8 *ram;
+  bool *done;
+  u32 *episode_frames;
+
+  // The step in progress.
+  const u16 *actions;
+  int frames_per_step;
+
+  ThreadPool pool;
+};
+
+// Clones `source`, which must outlive the batch since its ROM is shared,
+// as it is right now into `num_envs` instances. `threads` <= 0 uses one
+// per online CPU.
+bool vecenv_init(VecEnv *env, Gba *source, int num_envs, int threads);
+void vecenv_free(VecEnv *env);
+
+// Puts every instance back at the start of an episode and fills in its
+// observation and RAM.
+void vecenv_reset(VecEnv *env);
+
+// Holds each instance's KEYINPUT (active low) at `actions[i]` for
+// `frames_per_step` frames. Instances whose episode ended on the previous
+// step are reset first, so the batch never has to be reset as a whole.
+void vecenv_step(VecEnv *env, const u16 *actions, int frames_per_step);
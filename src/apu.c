@@ -1,4 +1,193 @@
 #include "apu.h"
+#include "dma.h"
+#include "gba.h"
+#include "timer.h"
 #include <string.h>
 
-void apu_init(Apu *apu) { memset(apu, 0, sizeof(Apu)); }
+void apu_init(Apu *apu) {
+  memset(apu, 0, sizeof(Apu));
+  for (int i = 0; i < 2; i++) {
+    apu->dsound[i].volume = 1;
+  }
+  psg_init(&apu->psg);
+}
+
+// When off, FIFOs, timers and FIFO DMA behave as usual but no samples are
+// generated: PSG synthesis and mixing are skipped entirely.
+void apu_set_synthesize(Gba *gba, bool enable) {
+  apu_sync(gba);
+  gba->synthesize = enable;
+}
+
+static void fifo_reset(Fifo *fifo) {
+  fifo->read = 0;
+  fifo->write = 0;
+  fifo->count = 0;
+}
+
+static void fifo_push(Fifo *fifo, s8 val) {
+  if (fifo->count == FIFO_SIZE) {
+    return;
+  }
+  fifo->data[fifo->write] = val;
+  fifo->write = (fifo->write + 1) % FIFO_SIZE;
+  fifo->count++;
+}
+
+static s8 fifo_pop(Fifo *fifo) {
+  if (fifo->count == 0) {
+    return fifo->sample;
+  }
+  s8 val = fifo->data[fifo->read];
+  fifo->read = (fifo->read + 1) % FIFO_SIZE;
+  fifo->count--;
+  return val;
+}
+
+static void push_sample(ApuBuffer *buffer, s16 left, s16 right) {
+  if (buffer->write - buffer->read == APU_BUFFER_SIZE) {
+    return;
+  }
+  s16 *frame = buffer->data[buffer->write % APU_BUFFER_SIZE];
+  frame[0] = left;
+  frame[1] = right;
+  buffer->write++;
+}
+
+static s16 mix_output(Apu *apu, int sample) {
+  int bias = GET_BITS(apu->soundbias, 0, 10) & ~1;
+  sample += bias;
+  sample = MIN(0x3FF, MAX(0, sample));
+  return (sample - 0x200) * 32;
+}
+
+static void output_sample(Gba *gba, uint time) {
+  Apu *apu = &gba->apu;
+  int left = 0;
+  int right = 0;
+
+  if (apu->master_enable) {
+    // SOUNDCNT_H bits 0-1: 25%, 50% or 100% (3 is prohibited)
+    int psg_shift = 2 - MIN(GET_BITS(apu->soundcnt_h, 0, 2), 2);
+    psg_sample(&apu->psg, time, &left, &right);
+    left >>= psg_shift;
+    right >>= psg_shift;
+
+    for (int i = 0; i < 2; i++) {
+      int sample = apu->fifo[i].sample << apu->dsound[i].volume;
+      if (apu->dsound[i].enable_left) {
+        left += sample;
+      }
+      if (apu->dsound[i].enable_right) {
+        right += sample;
+      }
+    }
+  }
+
+  push_sample(&gba->audio, mix_output(apu, left), mix_output(apu, right));
+}
+
+// Emits every output sample due up to the current time. Called before any
+// change that affects the output and by the frontend before draining.
+void apu_sync(Gba *gba) {
+  Apu *apu = &gba->apu;
+  uint now = gba->scheduler.current_time;
+
+  if (!gba->synthesize) {
+    // Only keep the sample clock in step so re-enabling resumes from now.
+    if ((int)(now - apu->next_sample_time) >= 0) {
+      uint due = (now - apu->next_sample_time) / APU_CYCLES_PER_SAMPLE + 1;
+      apu->next_sample_time += due * APU_CYCLES_PER_SAMPLE;
+    }
+    return;
+  }
+
+  while ((int)(now - apu->next_sample_time) >= 0) {
+    output_sample(gba, apu->next_sample_time);
+    apu->next_sample_time += APU_CYCLES_PER_SAMPLE;
+  }
+}
+
+int apu_read_samples(Gba *gba, s16 *dest, int frames) {
+  ApuBuffer *buffer = &gba->audio;
+  int available = buffer->write - buffer->read;
+  frames = MIN(frames, available);
+  for (int i = 0; i < frames; i++) {
+    s16 *frame = buffer->data[buffer->read % APU_BUFFER_SIZE];
+    dest[i * 2] = frame[0];
+    dest[i * 2 + 1] = frame[1];
+    buffer->read++;
+  }
+  return frames;
+}
+
+void apu_soundcnt_h_write(Gba *gba, u16 val) {
+  Apu *apu = &gba->apu;
+
+  // Which timers drive the FIFOs decides which overflows are observable.
+  timer_sync(gba);
+  apu_sync(gba);
+
+  apu->soundcnt_h = val & 0x770F;
+  for (int i = 0; i < 2; i++) {
+    apu->dsound[i].volume = TEST_BIT(val, 2 + i) ? 2 : 1;
+    apu->dsound[i].enable_right = TEST_BIT(val, 8 + i * 4);
+    apu->dsound[i].enable_left = TEST_BIT(val, 9 + i * 4);
+    apu->dsound[i].timer = TEST_BIT(val, 10 + i * 4);
+    if (TEST_BIT(val, 11 + i * 4)) {
+      fifo_reset(&apu->fifo[i]);
+    }
+  }
+
+  timer_reschedule(gba);
+}
+
+void apu_soundcnt_x_write(Gba *gba, u8 val) {
+  Apu *apu = &gba->apu;
+
+  timer_sync(gba);
+  apu_sync(gba);
+
+  apu->master_enable = TEST_BIT(val, 7);
+  apu->soundcnt_x = val & 0x80;
+  if (!apu->master_enable) {
+    for (int i = 0; i < 2; i++) {
+      fifo_reset(&apu->fifo[i]);
+      apu->fifo[i].sample = 0;
+    }
+    psg_disable(gba);
+  }
+
+  timer_reschedule(gba);
+}
+
+void apu_fifo_write(Gba *gba, int fifo, u8 val) {
+  fifo_push(&gba->apu.fifo[fifo], (s8)val);
+}
+
+bool apu_timer_in_use(Apu *apu, int tmr) {
+  return apu->master_enable &&
+         (apu->dsound[0].timer == tmr || apu->dsound[1].timer == tmr);
+}
+
+void apu_on_timer_overflow(Gba *gba, int tmr) {
+  Apu *apu = &gba->apu;
+
+  if (!apu->master_enable) {
+    return;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    if (apu->dsound[i].timer != tmr) {
+      continue;
+    }
+
+    apu_sync(gba);
+
+    Fifo *fifo = &apu->fifo[i];
+    fifo->sample = fifo_pop(fifo);
+    if (fifo->count <= FIFO_SIZE / 2) {
+      dma_on_fifo(gba, i);
+    }
+  }
+}
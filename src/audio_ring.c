@@ -0,0 +1,71 @@
+#include "audio_ring.h"
+#include <string.h>
+
+bool audio_ring_init(AudioRing *ring, u32 min_frames) {
+  memset(ring, 0, sizeof(AudioRing));
+
+  u32 size = 1;
+  while (size < min_frames) {
+    size <<= 1;
+  }
+
+  ring->data = malloc(size * 2 * sizeof(s16));
+  if (!ring->data) {
+    printf("Failed to allocate audio ring\n");
+    return false;
+  }
+  ring->size = size;
+  atomic_init(&ring->write, 0);
+  atomic_init(&ring->read, 0);
+  return true;
+}
+
+void audio_ring_free(AudioRing *ring) {
+  free(ring->data);
+  ring->data = NULL;
+}
+
+u32 audio_ring_fill(AudioRing *ring) {
+  u32 write = atomic_load_explicit(&ring->write, memory_order_acquire);
+  u32 read = atomic_load_explicit(&ring->read, memory_order_acquire);
+  return write - read;
+}
+
+// Copies `frames` frames between the ring at index `start` and `buf`,
+// wrapping at the end of the storage.
+static void copy_frames(AudioRing *ring, u32 start, s16 *buf, u32 frames,
+                        bool to_ring) {
+  u32 offset = start & (ring->size - 1);
+  u32 first = MIN(frames, ring->size - offset);
+  s16 *a = ring->data + offset * 2;
+  s16 *b = ring->data;
+  if (to_ring) {
+    memcpy(a, buf, first * 2 * sizeof(s16));
+    memcpy(b, buf + first * 2, (frames - first) * 2 * sizeof(s16));
+  } else {
+    memcpy(buf, a, first * 2 * sizeof(s16));
+    memcpy(buf + first * 2, b, (frames - first) * 2 * sizeof(s16));
+  }
+}
+
+u32 audio_ring_write(AudioRing *ring, const s16 *src, u32 frames) {
+  u32 write = atomic_load_explicit(&ring->write, memory_order_relaxed);
+  u32 read = atomic_load_explicit(&ring->read, memory_order_acquire);
+
+  frames = MIN(frames, ring->size - (write - read));
+  copy_frames(ring, write, (s16 *)src, frames, true);
+
+  atomic_store_explicit(&ring->write, write + frames, memory_order_release);
+  return frames;
+}
+
+u32 audio_ring_read(AudioRing *ring, s16 *dest, u32 frames) {
+  u32 read = atomic_load_explicit(&ring->read, memory_order_relaxed);
+  u32 write = atomic_load_explicit(&ring->write, memory_order_acquire);
+
+  frames = MIN(frames, write - read);
+  copy_frames(ring, read, dest, frames, false);
+
+  atomic_store_explicit(&ring->read, read + frames, memory_order_release);
+  return frames;
+}
@@ -1,103 +1,293 @@
 #include "backup.h"
 #include "bus.h"
+#include "dirty.h"
+#include <stddef.h>
 #include <string.h>
 
-void backup_init(Backup *backup, u8 *rom_data, u32 rom_size) {
-  if (memmem(rom_data, rom_size, "SRAM_", 5) != NULL) {
-    backup->type = BACKUP_SRAM;
+#define FLASH_BANK_SIZE 0x10000
+#define FLASH_SECTOR_SIZE 0x1000
+#define EEPROM_MAX_SIZE (8 * 1024)
+
+// The type comes from the ROM's analysis, see rominfo.h.
+void backup_init(Backup *backup, BackupType type) {
+  memset(backup, 0, offsetof(Backup, data));
+  backup->type = type;
+  switch (type) {
+  case BACKUP_SRAM:
     backup->size = 32 * 1024;
-  } else if (memmem(rom_data, rom_size, "FLASH_", 6) != NULL ||
-             memmem(rom_data, rom_size, "FLASH512_", 9) != NULL) {
-    backup->type = BACKUP_FLASH64;
+    break;
+  case BACKUP_EEPROM:
+    // Both sizes are kept in the larger layout so a save file doesn't
+    // depend on which one the game turns out to use.
+    backup->size = EEPROM_MAX_SIZE;
+    break;
+  case BACKUP_FLASH64:
     backup->size = 64 * 1024;
-  } else if (memmem(rom_data, rom_size, "FLASH1M_", 8) != NULL) {
-    backup->type = BACKUP_FLASH128;
+    break;
+  case BACKUP_FLASH128:
     backup->size = 128 * 1024;
+    break;
+  default:
+    backup->size = 0;
+    break;
   }
-  printf("%d\n", backup->type);
 
-  backup->data = malloc(backup->size);
   memset(backup->data, 0xFF, backup->size);
 }
 
-u8 backup_read8(Backup *backup, u32 address) {
-  u8 res;
-  switch (backup->type) {
-  case BACKUP_SRAM:
-    res = read_mem8(backup->data, address & (backup->size - 1));
+void backup_range_add(BackupRange *range, u32 start, u32 end) {
+  if (start >= end) {
+    return;
+  }
+  if (range->start >= range->end) {
+    range->start = start;
+    range->end = end;
+  } else {
+    range->start = MIN(range->start, start);
+    range->end = MAX(range->end, end);
+  }
+}
+
+static void store(Backup *backup, BackupRange *unsaved, DirtyMap *dirty,
+                  u32 offset, u8 val) {
+  if (backup->data[offset] != val) {
+    backup->data[offset] = val;
+    backup_range_add(unsaved, offset, offset + 1);
+    dirty_mark(dirty, DIRTY_BACKUP, offset);
+  }
+}
+
+static void flash_erase(Backup *backup, BackupRange *unsaved, DirtyMap *dirty,
+                        u32 offset, u32 size) {
+  memset(backup->data + offset, 0xFF, size);
+  backup_range_add(unsaved, offset, offset + size);
+  dirty_mark_range(dirty, DIRTY_BACKUP, offset, offset + size);
+}
+
+static u8 flash_read(Backup *backup, u32 address) {
+  u32 offset = address & 0xFFFF;
+  if (backup->flash_id_mode && offset < 2) {
+    // Panasonic for 64K, Sanyo for 128K; games only care about the size.
+    if (backup->type == BACKUP_FLASH64) {
+      return offset == 0 ? 0x32 : 0x1B;
+    }
+    return offset == 0 ? 0x62 : 0x13;
+  }
+  return backup->data[backup->flash_bank * FLASH_BANK_SIZE + offset];
+}
+
+static void flash_write(Backup *backup, BackupRange *unsaved, DirtyMap *dirty,
+                        u32 address, u8 val) {
+  u32 offset = address & 0xFFFF;
+  bool unlock1 = offset == 0x5555 && val == 0xAA;
+  bool unlock2 = offset == 0x2AAA && val == 0x55;
+  FlashState next = FLASH_READY;
+
+  switch (backup->flash_state) {
+  case FLASH_READY:
+    if (unlock1) {
+      next = FLASH_CMD1;
+    } else if (val == 0xF0) {
+      backup->flash_id_mode = false;
+    }
     break;
-  case BACKUP_FLASH64:
-    if (address == 0x0E000000) {
-      res = 0x32;
-    } else if (address == 0x0E000001) {
-      res = 0x1B;
-    } else {
-      res = 0xFF;
+  case FLASH_CMD1:
+    next = unlock2 ? FLASH_CMD2 : FLASH_READY;
+    break;
+  case FLASH_CMD2:
+    if (offset != 0x5555) {
+      break;
+    }
+    switch (val) {
+    case 0x90:
+      backup->flash_id_mode = true;
+      break;
+    case 0xF0:
+      backup->flash_id_mode = false;
+      break;
+    case 0x80:
+      next = FLASH_ERASE;
+      break;
+    case 0xA0:
+      next = FLASH_WRITE;
+      break;
+    case 0xB0:
+      if (backup->type == BACKUP_FLASH128) {
+        next = FLASH_BANK;
+      }
+      break;
     }
     break;
-  case BACKUP_FLASH128:
-    if (address == 0x0E000000) {
-      res = 0x62;
-    } else if (address == 0x0E000001) {
-      res = 0x13;
-    } else {
-      res = 0xFF;
+  case FLASH_ERASE:
+    next = unlock1 ? FLASH_ERASE_CMD1 : FLASH_READY;
+    break;
+  case FLASH_ERASE_CMD1:
+    next = unlock2 ? FLASH_ERASE_CMD2 : FLASH_READY;
+    break;
+  case FLASH_ERASE_CMD2:
+    if (offset == 0x5555 && val == 0x10) {
+      flash_erase(backup, unsaved, dirty, 0, backup->size);
+    } else if (val == 0x30) {
+      flash_erase(backup, unsaved, dirty,
+                  backup->flash_bank * FLASH_BANK_SIZE +
+                      (offset & ~(FLASH_SECTOR_SIZE - 1)),
+                  FLASH_SECTOR_SIZE);
     }
-
     break;
-  default:
-    res = 0xFF;
+  case FLASH_WRITE:
+    store(backup, unsaved, dirty, backup->flash_bank * FLASH_BANK_SIZE + offset,
+          val);
+    break;
+  case FLASH_BANK:
+    if (offset == 0) {
+      backup->flash_bank = val & 1;
+    }
     break;
   }
-  return res;
+  backup->flash_state = next;
 }
 
-void backup_write8(Backup *backup, u32 address, u8 val) {
-  if (backup->type == BACKUP_SRAM) {
-    write_mem8(backup->data, address & (backup->size - 1), val);
+// SRAM and Flash sit on an 8-bit bus: wider reads see the byte repeated
+// and wider writes store the byte lane the address selects.
+u8 backup_read8(Backup *backup, u32 address) {
+  switch (backup->type) {
+  case BACKUP_SRAM:
+    return read_mem8(backup->data, address & (backup->size - 1));
+  case BACKUP_FLASH64:
+  case BACKUP_FLASH128:
+    return flash_read(backup, address);
+  default:
+    return 0xFF;
   }
 }
 
-u16 backup_read16(Backup *backup, u32 address) {
-  u16 res;
+void backup_write8(Backup *backup, BackupRange *unsaved, DirtyMap *dirty,
+                   u32 address, u8 val) {
   switch (backup->type) {
   case BACKUP_SRAM:
-    res = read_mem8(backup->data, address & (backup->size - 1));
-    res |= res << 8;
+    store(backup, unsaved, dirty, address & (backup->size - 1), val);
+    break;
+  case BACKUP_FLASH64:
+  case BACKUP_FLASH128:
+    flash_write(backup, unsaved, dirty, address, val);
     break;
   default:
-    res = 0xFFFF;
     break;
   }
-  return res;
 }
 
-void backup_write16(Backup *backup, u32 address, u16 val) {
-  if (backup->type == BACKUP_SRAM) {
-    write_mem8(backup->data, address & (backup->size - 1), val);
-    write_mem8(backup->data, (address + 1) & (backup->size - 1), val);
-  }
+u16 backup_read16(Backup *backup, u32 address) {
+  return backup_read8(backup, address) * 0x0101;
+}
+
+void backup_write16(Backup *backup, BackupRange *unsaved, DirtyMap *dirty,
+                    u32 address, u16 val) {
+  backup_write8(backup, unsaved, dirty, address, val >> (8 * (address & 1)));
 }
 
 u32 backup_read32(Backup *backup, u32 address) {
-  u32 res;
-  switch (backup->type) {
-  case BACKUP_SRAM:
-    res = read_mem8(backup->data, address & (backup->size - 1));
-    res |= res << 24 | res << 16 | res << 8;
-    break;
-  default:
-    res = 0xFFFF;
-    break;
+  return backup_read8(backup, address) * 0x01010101u;
+}
+
+void backup_write32(Backup *backup, BackupRange *unsaved, DirtyMap *dirty,
+                    u32 address, u32 val) {
+  backup_write8(backup, unsaved, dirty, address, val >> (8 * (address & 3)));
+}
+
+void backup_eeprom_detect(Backup *backup, u32 count) {
+  if (count == 9 || count == 73) {
+    backup->eeprom_address_bits = 6;
+  } else if (count == 17 || count == 81) {
+    backup->eeprom_address_bits = 14;
+  }
+}
+
+static int eeprom_address_bits(Backup *backup) {
+  return backup->eeprom_address_bits ? backup->eeprom_address_bits : 14;
+}
+
+// Byte offset of the addressed 64-bit block. 14-bit addresses only use
+// the low 10 bits.
+static u32 eeprom_offset(Backup *backup) {
+  u32 mask = eeprom_address_bits(backup) == 6 ? 0x3F : 0x3FF;
+  return (backup->eeprom_address & mask) * 8;
+}
+
+u16 backup_eeprom_read(Backup *backup) {
+  if (backup->type != BACKUP_EEPROM ||
+      backup->eeprom_state != EEPROM_READ_DATA) {
+    // Idle, or done writing.
+    return 1;
+  }
+  int bit = backup->eeprom_bit_count++;
+  u16 res = 0;
+  if (bit >= 4) {
+    bit -= 4;
+    u8 byte = backup->data[eeprom_offset(backup) + bit / 8];
+    res = (byte >> (7 - bit % 8)) & 1;
+  }
+  if (backup->eeprom_bit_count == 68) {
+    backup->eeprom_state = EEPROM_COMMAND;
+    backup->eeprom_bit_count = 0;
   }
   return res;
 }
 
-void backup_write32(Backup *backup, u32 address, u32 val) {
-  if (backup->type == BACKUP_SRAM) {
-    write_mem8(backup->data, address & (backup->size - 1), val);
-    write_mem8(backup->data, (address + 1) & (backup->size - 1), val);
-    write_mem8(backup->data, (address + 2) & (backup->size - 1), val);
-    write_mem8(backup->data, (address + 3) & (backup->size - 1), val);
+void backup_eeprom_write(Backup *backup, BackupRange *unsaved,
+                         DirtyMap *dirty, u16 val) {
+  if (backup->type != BACKUP_EEPROM) {
+    return;
+  }
+  u32 bit = val & 1;
+  switch (backup->eeprom_state) {
+  case EEPROM_READ_DATA:
+    // An unfinished read is abandoned by the next request.
+    backup->eeprom_state = EEPROM_COMMAND;
+    backup->eeprom_bit_count = 0;
+    backup->eeprom_buffer = 0;
+    // fallthrough
+  case EEPROM_COMMAND:
+    backup->eeprom_buffer = (backup->eeprom_buffer << 1) | bit;
+    if (++backup->eeprom_bit_count == 2) {
+      if (backup->eeprom_buffer == 3) {
+        backup->eeprom_state = EEPROM_READ_ADDRESS;
+      } else if (backup->eeprom_buffer == 2) {
+        backup->eeprom_state = EEPROM_WRITE_ADDRESS;
+      }
+      backup->eeprom_bit_count = 0;
+      backup->eeprom_buffer = 0;
+      backup->eeprom_address = 0;
+    }
+    break;
+  case EEPROM_READ_ADDRESS:
+  case EEPROM_WRITE_ADDRESS:
+    backup->eeprom_address = (backup->eeprom_address << 1) | bit;
+    if (++backup->eeprom_bit_count == eeprom_address_bits(backup)) {
+      backup->eeprom_state = backup->eeprom_state == EEPROM_READ_ADDRESS
+                                 ? EEPROM_READ_END
+                                 : EEPROM_WRITE_DATA;
+      backup->eeprom_bit_count = 0;
+    }
+    break;
+  case EEPROM_READ_END:
+    backup->eeprom_state = EEPROM_READ_DATA;
+    break;
+  case EEPROM_WRITE_DATA:
+    backup->eeprom_buffer = (backup->eeprom_buffer << 1) | bit;
+    if (++backup->eeprom_bit_count == 64) {
+      backup->eeprom_state = EEPROM_WRITE_END;
+    }
+    break;
+  case EEPROM_WRITE_END: {
+    u32 offset = eeprom_offset(backup);
+    for (int i = 0; i < 8; i++) {
+      store(backup, unsaved, dirty, offset + i,
+            backup->eeprom_buffer >> (56 - 8 * i));
+    }
+    backup->eeprom_state = EEPROM_COMMAND;
+    backup->eeprom_bit_count = 0;
+    backup->eeprom_buffer = 0;
+    break;
+  }
   }
 }
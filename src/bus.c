@@ -1,6 +1,7 @@
 #include "bus.h"
 #include "backup.h"
 #include "cpu.h"
+#include "dirty.h"
 #include "gba.h"
 #include "io.h"
 #include <stdio.h>
@@ -151,6 +152,14 @@ static void add_cycles(Gba *gba, Access access, int region, int size) {
   scheduler_step(&gba->scheduler, cycles);
 }
 
+// EEPROM answers in the top half of the last cart region: all of it for
+// ROMs up to 16MB, only the last 256 bytes for bigger ones.
+bool bus_is_eeprom(Gba *gba, u32 address) {
+  return gba->backup.type == BACKUP_EEPROM &&
+         get_region(address) == REGION_CART_WS2_B &&
+         (gba->rom.size <= 0x1000000 || (address & 0xFFFFFF) >= 0xFFFF00);
+}
+
 u32 bus_read_bios(Gba *gba, u32 address) {
   u32 offset = address & ~3;
   if (PC < BIOS_SIZE) {
@@ -278,8 +287,12 @@ u16 bus_read16(Gba *gba, u32 address, Access access) {
   case REGION_CART_WS1_B:
   case REGION_CART_WS2_A:
   case REGION_CART_WS2_B:
+    if (bus_is_eeprom(gba, address)) {
+      res = backup_eeprom_read(&gba->backup);
+      break;
+    }
     offset = address & 0x1FFFFFF;
-    if (offset <= gba->rom.size) {
+    if (offset < gba->rom.size) {
       res = read_mem16(gba->rom.data, offset);
     } else {
       res = (address >> 1) & 0xFFFF;
@@ -350,7 +363,9 @@ u32 bus_read32(Gba *gba, u32 address, Access access) {
   case REGION_CART_WS2_A:
   case REGION_CART_WS2_B:
     offset = address & 0x1FFFFFF;
-    if (offset <= gba->rom.size) {
+    // The read is aligned, so one starting inside the ROM ends within its
+    // last mapped page even if the size isn't a multiple of four.
+    if (offset < gba->rom.size) {
       res = read_mem32(gba->rom.data, offset);
     } else {
       u16 lower = (address >> 1) & 0xFFFF;
@@ -382,17 +397,21 @@ void bus_write8(Gba *gba, u32 address, u8 data, Access access) {
   case REGION_EWRAM:
     offset = address & 0x3FFFF;
     write_mem8(gba->ewram, offset, data);
+    dirty_mark(&gba->dirty, DIRTY_EWRAM, offset);
     break;
   case REGION_IWRAM:
     offset = address & 0x7FFF;
     write_mem8(gba->iwram, offset, data);
+    dirty_mark(&gba->dirty, DIRTY_IWRAM, offset);
     break;
   case REGION_IO:
     io_write8(gba, address, data);
     break;
   case REGION_PALETTE:
-    offset = address & 0x3FF;
+    offset = address & 0x3FE;
     write_mem16(gba->ppu.palram, offset, (data << 8) | data);
+    gba->palette_dirty = true;
+    dirty_mark(&gba->dirty, DIRTY_PALETTE, offset);
     break;
   case REGION_VRAM:
     offset = address & 0x1FFFF;
@@ -403,7 +422,9 @@ void bus_write8(Gba *gba, u32 address, u8 data, Access access) {
       // obj vram
       break;
     } else {
+      offset &= ~1;
       write_mem16(gba->ppu.vram, offset, (data << 8) | data);
+      dirty_mark(&gba->dirty, DIRTY_VRAM, offset);
     }
     break;
   case REGION_OAM:
@@ -411,7 +432,7 @@ void bus_write8(Gba *gba, u32 address, u8 data, Access access) {
     break;
   case REGION_SRAM:
   case REGION_UNUSED:
-    backup_write8(&gba->backup, address, data);
+    backup_write8(&gba->backup, &gba->unsaved, &gba->dirty, address, data);
     break;
   default:
     break;
@@ -431,10 +452,12 @@ void bus_write16(Gba *gba, u32 address, u16 data, Access access) {
   case REGION_EWRAM:
     offset = address & 0x3FFFF;
     write_mem16(gba->ewram, offset, data);
+    dirty_mark(&gba->dirty, DIRTY_EWRAM, offset);
     break;
   case REGION_IWRAM:
     offset = address & 0x7FFF;
     write_mem16(gba->iwram, offset, data);
+    dirty_mark(&gba->dirty, DIRTY_IWRAM, offset);
     break;
   case REGION_IO:
     io_write16(gba, address, data);
@@ -442,6 +465,8 @@ void bus_write16(Gba *gba, u32 address, u16 data, Access access) {
   case REGION_PALETTE:
     offset = address & 0x3FF;
     write_mem16(gba->ppu.palram, offset, data);
+    gba->palette_dirty = true;
+    dirty_mark(&gba->dirty, DIRTY_PALETTE, offset);
     break;
   case REGION_VRAM:
     offset = address & 0x1FFFF;
@@ -449,14 +474,22 @@ void bus_write16(Gba *gba, u32 address, u16 data, Access access) {
       offset &= 0x17FFF;
     }
     write_mem16(gba->ppu.vram, offset, data);
+    dirty_mark(&gba->dirty, DIRTY_VRAM, offset);
     break;
   case REGION_OAM:
     offset = address & 0x3FF;
     write_mem16(gba->ppu.oam, offset, data);
+    dirty_mark(&gba->dirty, DIRTY_OAM, offset);
+    break;
+  case REGION_CART_WS2_B:
+    if (bus_is_eeprom(gba, address)) {
+      backup_eeprom_write(&gba->backup, &gba->unsaved, &gba->dirty,
+                          data);
+    }
     break;
   case REGION_SRAM:
   case REGION_UNUSED:
-    backup_write16(&gba->backup, address, data);
+    backup_write16(&gba->backup, &gba->unsaved, &gba->dirty, address, data);
     break;
   default:
     break;
@@ -476,10 +509,12 @@ void bus_write32(Gba *gba, u32 address, u32 data, Access access) {
   case REGION_EWRAM:
     offset = address & 0x3FFFF;
     write_mem32(gba->ewram, offset, data);
+    dirty_mark(&gba->dirty, DIRTY_EWRAM, offset);
     break;
   case REGION_IWRAM:
     offset = address & 0x7FFF;
     write_mem32(gba->iwram, offset, data);
+    dirty_mark(&gba->dirty, DIRTY_IWRAM, offset);
     break;
   case REGION_IO:
     io_write32(gba, address, data);
@@ -487,6 +522,8 @@ void bus_write32(Gba *gba, u32 address, u32 data, Access access) {
   case REGION_PALETTE:
     offset = address & 0x3FF;
     write_mem32(gba->ppu.palram, offset, data);
+    gba->palette_dirty = true;
+    dirty_mark(&gba->dirty, DIRTY_PALETTE, offset);
     break;
   case REGION_VRAM:
     offset = address & 0x1FFFF;
@@ -494,14 +531,16 @@ void bus_write32(Gba *gba, u32 address, u32 data, Access access) {
       offset &= 0x17FFF;
     }
     write_mem32(gba->ppu.vram, offset, data);
+    dirty_mark(&gba->dirty, DIRTY_VRAM, offset);
     break;
   case REGION_OAM:
     offset = address & 0x3FF;
     write_mem32(gba->ppu.oam, offset, data);
+    dirty_mark(&gba->dirty, DIRTY_OAM, offset);
     break;
   case REGION_SRAM:
   case REGION_UNUSED:
-    backup_write32(&gba->backup, address, data);
+    backup_write32(&gba->backup, &gba->unsaved, &gba->dirty, address, data);
     break;
   default:
     break;
@@ -0,0 +1,325 @@
+#include "checkpoint.h"
+#include "crc32.h"
+#include "gba.h"
+#include "lz.h"
+#include <string.h>
+#include <unistd.h>
+
+#define MAGIC "GBACHKPT"
+#define MAGIC_SIZE 8
+#define VERSION 2
+#define HEADER_SIZE (MAGIC_SIZE + 12)
+#define RECORD_HEADER_SIZE 28
+
+#define RECORD_FULL 0
+#define RECORD_DELTA 1
+
+// Changed ranges are whole pages or the gaps between tracked memories,
+// so there are never more of them than pages plus a few.
+#define STAGING_BOUND (GBA_STATE_SIZE + 8 * (DIRTY_PAGES + 16))
+
+typedef struct {
+  Checkpoint *ck;
+  const u8 *state;
+} Stage;
+
+static void stage_range(void *ctx, size_t offset, size_t size) {
+  Stage *stage = ctx;
+  Checkpoint *ck = stage->ck;
+  u8 *out = ck->staging + ck->staging_size;
+  put32(out, offset);
+  put32(out + 4, size);
+  memcpy(out + 8, stage->state + offset, size);
+  ck->staging_size += 8 + size;
+}
+
+static bool apply_ranges(u8 *state, const u8 *in, size_t size) {
+  const u8 *end = in + size;
+  while (in < end) {
+    if (end - in < 8) {
+      return false;
+    }
+    u32 offset = get32(in);
+    u32 length = get32(in + 4);
+    in += 8;
+    if (offset > GBA_STATE_SIZE || length > GBA_STATE_SIZE - offset ||
+        (size_t)(end - in) < length) {
+      return false;
+    }
+    memcpy(state + offset, in, length);
+    in += length;
+  }
+  return true;
+}
+
+static bool write_header(FILE *file, u32 rom_crc) {
+  u8 header[HEADER_SIZE];
+  memcpy(header, MAGIC, MAGIC_SIZE);
+  put32(header + MAGIC_SIZE, VERSION);
+  put32(header + MAGIC_SIZE + 4, GBA_STATE_SIZE);
+  put32(header + MAGIC_SIZE + 8, rom_crc);
+  return fwrite(header, 1, HEADER_SIZE, file) == HEADER_SIZE;
+}
+
+// Appends one record and makes sure it reached the disk.
+static bool write_record(Checkpoint *ck, FILE *file, u32 type,
+                         const u8 *data, size_t size) {
+  size_t compressed = lz_compress(data, size, ck->compressed);
+  u8 header[RECORD_HEADER_SIZE];
+  put32(header, type);
+  put32(header + 4, ck->sequence);
+  put32(header + 8, ck->staging_tag);
+  put32(header + 12, ck->staging_tag >> 32);
+  put32(header + 16, size);
+  put32(header + 20, compressed);
+  put32(header + 24, crc32(crc32(0, header, RECORD_HEADER_SIZE - 4),
+                           ck->compressed, compressed));
+  bool ok = fwrite(header, 1, RECORD_HEADER_SIZE, file) == RECORD_HEADER_SIZE &&
+            fwrite(ck->compressed, 1, compressed, file) == compressed &&
+            fflush(file) == 0 && fdatasync(fileno(file)) == 0;
+  if (ok) {
+    ck->file_size += RECORD_HEADER_SIZE + compressed;
+  }
+  return ok;
+}
+
+// Starts a new file holding just the current state. It's renamed over the
+// old one only once complete, so a crash leaves one or the other.
+static bool compact(Checkpoint *ck) {
+  char temp[sizeof(ck->path) + 8];
+  snprintf(temp, sizeof(temp), "%s.tmp", ck->path);
+  FILE *file = fopen(temp, "wb");
+  if (!file) {
+    return false;
+  }
+  ck->file_size = HEADER_SIZE;
+  bool ok = write_header(file, ck->rom_crc) &&
+            write_record(ck, file, RECORD_FULL, ck->mirror, GBA_STATE_SIZE);
+  ok &= fclose(file) == 0;
+  if (!ok || rename(temp, ck->path) != 0) {
+    unlink(temp);
+    return false;
+  }
+  if (ck->file) {
+    fclose(ck->file);
+  }
+  ck->file = fopen(ck->path, "ab");
+  return ck->file != NULL;
+}
+
+static bool write_checkpoint(Checkpoint *ck) {
+  if (!apply_ranges(ck->mirror, ck->staging, ck->staging_size)) {
+    return false;
+  }
+  bool ok;
+  if (ck->since_full > 0) {
+    ok = write_record(ck, ck->file, RECORD_DELTA, ck->staging,
+                      ck->staging_size);
+  } else if (!ck->file || (ck->max_bytes && ck->file_size > ck->max_bytes)) {
+    ok = compact(ck);
+  } else {
+    ok = write_record(ck, ck->file, RECORD_FULL, ck->mirror, GBA_STATE_SIZE);
+  }
+  ck->sequence++;
+  if (!ok) {
+    // Whatever follows a partly written record is unreadable, so start
+    // over with a fresh file at the next checkpoint.
+    if (ck->file) {
+      fclose(ck->file);
+      ck->file = NULL;
+    }
+    ck->since_full = 0;
+    return false;
+  }
+  ck->since_full = (ck->since_full + 1) % ck->full_interval;
+  return true;
+}
+
+static void *worker(void *arg) {
+  Checkpoint *ck = arg;
+  pthread_mutex_lock(&ck->lock);
+  while (true) {
+    while (!ck->pending && !ck->quit) {
+      pthread_cond_wait(&ck->cond, &ck->lock);
+    }
+    if (!ck->pending) {
+      break;
+    }
+    pthread_mutex_unlock(&ck->lock);
+    bool ok = write_checkpoint(ck);
+    if (!ok) {
+      printf("Failed to write checkpoint to %s\n", ck->path);
+    }
+    pthread_mutex_lock(&ck->lock);
+    ck->pending = false;
+    pthread_cond_broadcast(&ck->cond);
+  }
+  pthread_mutex_unlock(&ck->lock);
+  return NULL;
+}
+
+bool checkpoint_open(Checkpoint *ck, Gba *gba, const char *path, int interval,
+                     int full_interval, u64 max_bytes) {
+  memset(ck, 0, sizeof(Checkpoint));
+  snprintf(ck->path, sizeof(ck->path), "%s", path);
+  ck->rom_crc = gba->rom.info.crc;
+  ck->interval = MAX(interval, 1);
+  ck->full_interval = MAX(full_interval, 1);
+  ck->max_bytes = max_bytes;
+
+  ck->staging = malloc(STAGING_BOUND);
+  ck->mirror = malloc(GBA_STATE_SIZE);
+  ck->compressed = malloc(LZ_BOUND(STAGING_BOUND));
+  if (!ck->staging || !ck->mirror || !ck->compressed) {
+    printf("Failed to allocate checkpoint buffers\n");
+    goto fail;
+  }
+
+  pthread_mutex_init(&ck->lock, NULL);
+  pthread_cond_init(&ck->cond, NULL);
+  if (pthread_create(&ck->thread, NULL, worker, ck) != 0) {
+    printf("Failed to start checkpoint thread\n");
+    pthread_cond_destroy(&ck->cond);
+    pthread_mutex_destroy(&ck->lock);
+    goto fail;
+  }
+  // Memory the dirty map doesn't cover, like the BIOS, only ever reaches
+  // the mirror here. The first checkpoint is a full one and replaces
+  // whatever the file held before.
+  gba_snapshot(gba, ck->mirror);
+  dirty_mark_all(&gba->dirty);
+  ck->counter = ck->interval - 1;
+  return true;
+
+fail:
+  free(ck->staging);
+  free(ck->mirror);
+  free(ck->compressed);
+  memset(ck, 0, sizeof(Checkpoint));
+  return false;
+}
+
+void checkpoint_close(Checkpoint *ck) {
+  if (!ck->staging) {
+    return;
+  }
+  pthread_mutex_lock(&ck->lock);
+  ck->quit = true;
+  pthread_cond_broadcast(&ck->cond);
+  pthread_mutex_unlock(&ck->lock);
+  pthread_join(ck->thread, NULL);
+  pthread_cond_destroy(&ck->cond);
+  pthread_mutex_destroy(&ck->lock);
+
+  if (ck->file) {
+    fclose(ck->file);
+  }
+  free(ck->staging);
+  free(ck->mirror);
+  free(ck->compressed);
+  memset(ck, 0, sizeof(Checkpoint));
+}
+
+void checkpoint_capture(Checkpoint *ck, Gba *gba, u64 tag) {
+  if (!ck->staging || ++ck->counter < ck->interval) {
+    return;
+  }
+
+  pthread_mutex_lock(&ck->lock);
+  bool busy = ck->pending;
+  pthread_mutex_unlock(&ck->lock);
+  if (busy) {
+    // The dirty map keeps collecting, so nothing is lost by waiting.
+    return;
+  }
+  ck->counter = 0;
+
+  // The worker only touches the staging buffer while `pending` is set.
+  ck->staging_size = 0;
+  Stage stage = {ck, (const u8 *)gba};
+  gba_changed_ranges(gba, stage_range, &stage);
+  dirty_clear(&gba->dirty);
+  ck->staging_tag = tag;
+
+  pthread_mutex_lock(&ck->lock);
+  ck->pending = true;
+  pthread_cond_signal(&ck->cond);
+  pthread_mutex_unlock(&ck->lock);
+}
+
+bool checkpoint_restore(Gba *gba, const char *path, s64 sequence, u64 *tag) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    printf("Failed to open checkpoint file: %s\n", path);
+    return false;
+  }
+  u8 header[HEADER_SIZE];
+  if (fread(header, 1, HEADER_SIZE, file) != HEADER_SIZE ||
+      memcmp(header, MAGIC, MAGIC_SIZE) != 0 ||
+      get32(header + MAGIC_SIZE) != VERSION ||
+      get32(header + MAGIC_SIZE + 4) != GBA_STATE_SIZE) {
+    printf("Not a checkpoint file for this build: %s\n", path);
+    fclose(file);
+    return false;
+  }
+  if (get32(header + MAGIC_SIZE + 8) != gba->rom.info.crc) {
+    printf("Checkpoints are for a different ROM\n");
+    fclose(file);
+    return false;
+  }
+
+  u8 *state = malloc(GBA_STATE_SIZE);
+  u8 *raw = malloc(STAGING_BOUND);
+  u8 *compressed = malloc(LZ_BOUND(STAGING_BOUND));
+  bool have_state = false;
+  bool found = false;
+  u64 found_tag = 0;
+
+  // Replays up to the wanted record; a torn or corrupt one ends the file.
+  u8 record[RECORD_HEADER_SIZE];
+  while (state && raw && compressed &&
+         fread(record, 1, RECORD_HEADER_SIZE, file) == RECORD_HEADER_SIZE) {
+    u32 type = get32(record);
+    u32 seq = get32(record + 4);
+    u64 record_tag = get32(record + 8) | (u64)get32(record + 12) << 32;
+    u32 size = get32(record + 16);
+    u32 compressed_size = get32(record + 20);
+    if (sequence >= 0 && seq > sequence) {
+      break;
+    }
+    bool ok = (type == RECORD_FULL ? size == GBA_STATE_SIZE
+                                   : type == RECORD_DELTA) &&
+              size <= STAGING_BOUND &&
+              compressed_size <= LZ_BOUND(STAGING_BOUND) &&
+              fread(compressed, 1, compressed_size, file) == compressed_size &&
+              crc32(crc32(0, record, RECORD_HEADER_SIZE - 4), compressed,
+                    compressed_size) == get32(record + 24);
+    if (ok && type == RECORD_FULL) {
+      ok = lz_decompress(compressed, compressed_size, state, GBA_STATE_SIZE);
+      have_state = ok;
+    } else if (ok) {
+      ok = have_state &&
+           lz_decompress(compressed, compressed_size, raw, size) &&
+           apply_ranges(state, raw, size);
+    }
+    if (!ok) {
+      break;
+    }
+    found = sequence < 0 || seq == sequence;
+    found_tag = record_tag;
+  }
+  fclose(file);
+
+  if (found && have_state) {
+    gba_restore(gba, state);
+    if (tag) {
+      *tag = found_tag;
+    }
+  } else {
+    printf("Checkpoint not found in %s\n", path);
+  }
+  free(state);
+  free(raw);
+  free(compressed);
+  return found && have_state;
+}
@@ -1,26 +1,44 @@
 #include "cpu.h"
 #include "gba.h"
+#include <pthread.h>
+#include <stddef.h>
 #include <string.h>
 
-void cpu_init(Cpu *cpu) {
-  memset(cpu, 0, sizeof(Cpu));
+// The decode tables are shared by every instance; build them once even
+// when several threads start instances at the same time.
+static pthread_once_t lut_once = PTHREAD_ONCE_INIT;
+
+static void init_luts(void) {
   arm_init_lut();
   thumb_init_lut();
+}
+
+void cpu_init(Cpu *cpu) {
+  memset(cpu, 0, sizeof(Cpu));
+  pthread_once(&lut_once, init_luts);
 
   cpu->regs[13] = cpu->regs_fiq[5] = cpu->regs_abt[0] = cpu->regs_und[0] =
       0x03007F00;
   cpu->regs_svc[0] = cpu->regs_irq[0] = 0x03007FE0;
 
-  cpu->regs[15] = 0x08000000;
-
-  cpu->cpsr |= MODE_SYS | CPSR_I | CPSR_F;
-
-  cpu->spsr = &cpu->cpsr;
-
   cpu->regs[15] = 0x00000000;
   cpu->cpsr |= MODE_SVC | CPSR_I | CPSR_F;
-  cpu->spsr = &cpu->cpsr;
+  cpu->spsr_offset = offsetof(Cpu, cpsr);
+
+  cpu->next_fetch_access = ACCESS_NONSEQ;
+}
 
+// Registers as the BIOS leaves them when it jumps to the cartridge: each
+// mode's stack set up, system mode with interrupts enabled.
+void cpu_skip_bios(Cpu *cpu) {
+  memset(cpu, 0, offsetof(Cpu, next_fetch_access));
+  cpu->regs_svc[0] = 0x03007FE0;
+  cpu->regs_irq[0] = 0x03007FA0;
+
+  cpu->regs[13] = 0x03007F00;
+  cpu->regs[15] = 0x08000000;
+  cpu->cpsr = MODE_SYS;
+  cpu->spsr_offset = offsetof(Cpu, cpsr);
   cpu->next_fetch_access = ACCESS_NONSEQ;
 }
 
@@ -81,7 +99,7 @@ void cpu_set_mode(Cpu *cpu, u32 new_mode) {
   case MODE_SYS:
     cpu->regs[13] = cpu->regs_usr[0];
     cpu->regs[14] = cpu->regs_usr[1];
-    cpu->spsr = &cpu->cpsr;
+    cpu->spsr_offset = offsetof(Cpu, cpsr);
     break;
   case MODE_FIQ:
     cpu->regs[8] = cpu->regs_fiq[0];
@@ -91,27 +109,27 @@ void cpu_set_mode(Cpu *cpu, u32 new_mode) {
     cpu->regs[12] = cpu->regs_fiq[4];
     cpu->regs[13] = cpu->regs_fiq[5];
     cpu->regs[14] = cpu->regs_fiq[6];
-    cpu->spsr = &cpu->spsr_fiq;
+    cpu->spsr_offset = offsetof(Cpu, spsr_fiq);
     break;
   case MODE_SVC:
     cpu->regs[13] = cpu->regs_svc[0];
     cpu->regs[14] = cpu->regs_svc[1];
-    cpu->spsr = &cpu->spsr_svc;
+    cpu->spsr_offset = offsetof(Cpu, spsr_svc);
     break;
   case MODE_ABT:
     cpu->regs[13] = cpu->regs_abt[0];
     cpu->regs[14] = cpu->regs_abt[1];
-    cpu->spsr = &cpu->spsr_abt;
+    cpu->spsr_offset = offsetof(Cpu, spsr_abt);
     break;
   case MODE_IRQ:
     cpu->regs[13] = cpu->regs_irq[0];
     cpu->regs[14] = cpu->regs_irq[1];
-    cpu->spsr = &cpu->spsr_irq;
+    cpu->spsr_offset = offsetof(Cpu, spsr_irq);
     break;
   case MODE_UND:
     cpu->regs[13] = cpu->regs_und[0];
     cpu->regs[14] = cpu->regs_und[1];
-    cpu->spsr = &cpu->spsr_und;
+    cpu->spsr_offset = offsetof(Cpu, spsr_und);
     break;
   }
 
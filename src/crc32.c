@@ -0,0 +1,47 @@
+#include "crc32.h"
+#include <pthread.h>
+#include <string.h>
+
+// Slicing-by-8: eight tables let the loop fold in a whole 64-bit word per
+// step instead of a byte, several times faster on large inputs like ROMs.
+static u32 table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void init_table(void) {
+  for (u32 i = 0; i < 256; i++) {
+    u32 c = i;
+    for (int k = 0; k < 8; k++) {
+      c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    }
+    table[0][i] = c;
+  }
+  for (u32 i = 0; i < 256; i++) {
+    for (int t = 1; t < 8; t++) {
+      table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+    }
+  }
+}
+
+u32 crc32(u32 crc, const u8 *data, size_t size) {
+  pthread_once(&table_once, init_table);
+  crc = ~crc;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    u32 lo, hi;
+    memcpy(&lo, data + i, 4);
+    memcpy(&hi, data + i + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    lo = __builtin_bswap32(lo);
+    hi = __builtin_bswap32(hi);
+#endif
+    lo ^= crc;
+    crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+          table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+          table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+          table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+  }
+  for (; i < size; i++) {
+    crc = table[0][(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
@@ -0,0 +1,54 @@
+#include "dirty.h"
+#include <string.h>
+
+void dirty_mark_range(DirtyMap *map, DirtyRegion region, u32 start, u32 end) {
+  if (start >= end) {
+    return;
+  }
+  u32 first = dirty_region_base[region] + (start >> DIRTY_PAGE_SHIFT);
+  u32 last = dirty_region_base[region] + ((end - 1) >> DIRTY_PAGE_SHIFT);
+  for (u32 page = first; page <= last; page++) {
+    map->bits[page / 64] |= 1ull << (page % 64);
+  }
+}
+
+void dirty_mark_all(DirtyMap *map) {
+  dirty_mark_range(map, DIRTY_EWRAM, 0, DIRTY_PAGES << DIRTY_PAGE_SHIFT);
+}
+
+void dirty_clear(DirtyMap *map) { memset(map->bits, 0, sizeof(map->bits)); }
+
+u32 dirty_region_pages(DirtyRegion region) {
+  return dirty_region_base[region + 1] - dirty_region_base[region];
+}
+
+bool dirty_test(const DirtyMap *map, DirtyRegion region, u32 page) {
+  page += dirty_region_base[region];
+  return (map->bits[page / 64] >> (page % 64)) & 1;
+}
+
+int dirty_next(const DirtyMap *map, DirtyRegion region, u32 page) {
+  u32 base = dirty_region_base[region];
+  u32 end = dirty_region_base[region + 1];
+  u32 bit = base + page;
+  while (bit < end) {
+    // Whole clean words are skipped at once.
+    u64 word = map->bits[bit / 64] >> (bit % 64);
+    if (word == 0) {
+      bit = (bit / 64 + 1) * 64;
+      continue;
+    }
+    bit += __builtin_ctzll(word);
+    return bit < end ? (int)(bit - base) : -1;
+  }
+  return -1;
+}
+
+u32 dirty_count(const DirtyMap *map, DirtyRegion region) {
+  u32 count = 0;
+  for (int page = dirty_next(map, region, 0); page >= 0;
+       page = dirty_next(map, region, page + 1)) {
+    count++;
+  }
+  return count;
+}
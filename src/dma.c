@@ -1,8 +1,10 @@
 #include "dma.h"
+#include "backup.h"
 #include "bus.h"
 #include "common.h"
 #include "gba.h"
 #include "interrupt.h"
+#include "io.h"
 #include <assert.h>
 #include <string.h>
 
@@ -15,7 +17,7 @@ void dma_on_vblank(Gba *gba) {
     if (control.enable && control.timing == TIMING_MODE_VBLANK) {
       dma->channels[ch].access = ACCESS_NONSEQ;
       scheduler_push_event_ctx(&gba->scheduler, EVENT_TYPE_DMA_ACTIVATE, 0,
-                               (void *)(intptr_t)ch);
+                               ch);
     }
   }
 }
@@ -27,11 +29,33 @@ void dma_on_hblank(Gba *gba) {
     if (control.enable && control.timing == TIMING_MODE_HBLANK) {
       dma->channels[ch].access = ACCESS_NONSEQ;
       scheduler_push_event_ctx(&gba->scheduler, EVENT_TYPE_DMA_ACTIVATE, 0,
-                               (void *)(intptr_t)ch);
+                               ch);
     }
   }
 }
 
+// Sound FIFO requests are served by channels 1 and 2 in special timing
+// mode, whichever has the FIFO as its destination.
+void dma_on_fifo(Gba *gba, int fifo) {
+  Dma *dma = &gba->dma;
+  u32 fifo_addr = fifo == 0 ? FIFO_A_L : FIFO_B;
+  for (int ch = 1; ch < 3; ch++) {
+    DmaChannel *channel = &dma->channels[ch];
+    DmaControl control = channel->control;
+    if (control.enable && control.timing == TIMING_MODE_REFRESH &&
+        channel->dst_addr == fifo_addr) {
+      channel->access = ACCESS_NONSEQ;
+      channel->internal_count = 4;
+      scheduler_push_event_ctx(&gba->scheduler, EVENT_TYPE_DMA_ACTIVATE, 0,
+                               ch);
+    }
+  }
+}
+
+static bool dma_is_fifo(DmaChannel *channel, int ch) {
+  return (ch == 1 || ch == 2) && channel->control.timing == TIMING_MODE_REFRESH;
+}
+
 void dma_transfer(Gba *gba, int ch) {
   Dma *dma = &gba->dma;
   DmaChannel *channel = &dma->channels[ch];
@@ -39,6 +63,12 @@ void dma_transfer(Gba *gba, int ch) {
 
   Access access = ACCESS_NONSEQ;
 
+  // Sound FIFO transfers are always four words to a fixed address.
+  bool fifo = dma_is_fifo(channel, ch);
+  int chunk_size = fifo ? 4 : control->chunk_size;
+  AdjustmentMode dst_adjustment =
+      fifo ? ADJUSTMENT_MODE_FIXED : control->dst_adjustment;
+
   u32 src = channel->internal_src_addr;
   u32 dst = channel->internal_dst_addr;
 
@@ -53,7 +83,7 @@ void dma_transfer(Gba *gba, int ch) {
   }
   // } else {
   if (src_region >= REGION_SRAM) {
-    if (control->chunk_size == 4) {
+    if (chunk_size == 4) {
       src &= ~3;
     } else {
       src &= ~1;
@@ -68,15 +98,20 @@ void dma_transfer(Gba *gba, int ch) {
   }
   // } else {
   if (dst_region >= REGION_SRAM) {
-    if (control->chunk_size == 4) {
+    if (chunk_size == 4) {
       dst &= ~3;
     } else {
       dst &= ~1;
     }
   }
 
+  // The length of the first request tells how big the EEPROM is.
+  if (ch == 3 && bus_is_eeprom(gba, dst)) {
+    backup_eeprom_detect(&gba->backup, channel->internal_count);
+  }
+
   for (; channel->internal_count > 0; channel->internal_count--) {
-    if (control->chunk_size == 4) {
+    if (chunk_size == 4) {
       if (src >= 0x02000000) {
         dma->last_load = bus_read32(gba, src, access);
       }
@@ -92,31 +127,31 @@ void dma_transfer(Gba *gba, int ch) {
     access = ACCESS_SEQ;
 
     if (src_region >= REGION_CART_WS0_A && src_region <= REGION_CART_WS2_B) {
-      src += control->chunk_size;
+      src += chunk_size;
     } else {
       switch (control->src_adjustment) {
       case ADJUSTMENT_MODE_FIXED:
         break;
       case ADJUSTMENT_MODE_DECREMENT:
-        src -= control->chunk_size;
+        src -= chunk_size;
         break;
       case ADJUSTMENT_MODE_INCREMENT:
-        src += control->chunk_size;
+        src += chunk_size;
         break;
       case ADJUSTMENT_MODE_RELOAD:
         assert(false);
       }
     }
 
-    switch (control->dst_adjustment) {
+    switch (dst_adjustment) {
     case ADJUSTMENT_MODE_FIXED:
       break;
     case ADJUSTMENT_MODE_DECREMENT:
-      dst -= control->chunk_size;
+      dst -= chunk_size;
       break;
     case ADJUSTMENT_MODE_INCREMENT:
     case ADJUSTMENT_MODE_RELOAD:
-      dst += control->chunk_size;
+      dst += chunk_size;
       break;
     }
   }
@@ -128,7 +163,9 @@ void dma_transfer(Gba *gba, int ch) {
     if (control->dst_adjustment == ADJUSTMENT_MODE_RELOAD) {
       channel->internal_dst_addr = channel->dst_addr;
     }
-    if (channel->count == 0) {
+    if (fifo) {
+      channel->internal_count = 4;
+    } else if (channel->count == 0) {
       if (ch == 3) {
         channel->internal_count = 0x10000;
       } else {
@@ -178,7 +215,7 @@ void dma_control_write(Gba *gba, int ch, u16 val) {
     if (control->timing == TIMING_MODE_NOW) {
       dma->channels[ch].access = ACCESS_NONSEQ;
       scheduler_push_event_ctx(&gba->scheduler, EVENT_TYPE_DMA_ACTIVATE, 0,
-                               (void *)(intptr_t)ch);
+                               ch);
     }
   }
 }
@@ -2,18 +2,7 @@
 #include "backup.h"
 #include <string.h>
 
-bool gba_init(Gba *gba, const char *bios_path, const char *rom_path) {
-  memset(gba, 0, sizeof(Gba));
-
-  if (!load_bios(gba->bios, bios_path)) {
-    printf("Failed to load BIOS: %s\n", bios_path);
-    return false;
-  }
-  if (!load_rom(&gba->rom, rom_path)) {
-    printf("Failed to load ROM: %s\n", rom_path);
-    return false;
-  }
-
+static void power_on(Gba *gba) {
   cpu_init(&gba->cpu);
   bus_init(&gba->bus);
   ppu_init(&gba->ppu);
@@ -24,20 +13,272 @@ bool gba_init(Gba *gba, const char *bios_path, const char *rom_path) {
   timer_init(&gba->tmr_mgr);
   interrupt_init(&gba->int_mgr);
   scheduler_init(&gba->scheduler);
-  backup_init(&gba->backup, gba->rom.data, gba->rom.size);
+  backup_init(&gba->backup, gba->rom.info.save_type);
 
   arm_fetch(gba);
   scheduler_push_event(&gba->scheduler, EVENT_TYPE_HBLANK_START,
                        H_VISIBLE_CYCLES);
+  dirty_mark_all(&gba->dirty);
+}
+
+bool gba_init(Gba *gba, const char *bios_path, const char *rom_path) {
+  memset(gba, 0, sizeof(Gba));
+
+  if (!load_bios(gba->bios, bios_path)) {
+    printf("Failed to load BIOS: %s\n", bios_path);
+    return false;
+  }
+  if (!load_rom(&gba->rom, rom_path)) {
+    printf("Failed to load ROM: %s\n", rom_path);
+    return false;
+  }
+
+  power_on(gba);
+  gba->palette_dirty = true;
+  gba->synthesize = true;
   return true;
 }
 
-void gba_free(Gba *gba) {
-  free(gba->rom.data);
-  free(gba->rom.title);
-  free(gba->rom.code);
-  free(gba->rom.maker);
-  free(gba->backup.data);
+// Starts an instance on a BIOS image and ROM loaded once by the caller, for
+// running many instances of the same game. The ROM must outlive it.
+void gba_init_shared(Gba *gba, const u8 *bios, const Rom *rom) {
+  memset(gba, 0, sizeof(Gba));
+  memcpy(gba->bios, bios, sizeof(gba->bios));
+  gba->rom = *rom;
+  gba->rom.owned = false;
+  power_on(gba);
+  gba->palette_dirty = true;
+  gba->synthesize = true;
+}
+
+// Starts in the cartridge as if the BIOS had just finished booting. Call
+// right after init, before running any frame.
+void gba_skip_bios(Gba *gba) {
+  cpu_skip_bios(&gba->cpu);
+  // Set by the BIOS once it has booted, and what reads of the BIOS area
+  // return after it jumped out.
+  gba->io.postflg = 1;
+  gba->bus.bios_last_load = 0xE129F000;
+  gba->apu.soundbias = 0x200;
+  arm_fetch(gba);
+}
+
+void gba_free(Gba *gba) { free_rom(&gba->rom); }
+
+// Runs until the end of the current frame, or with `stop` until the CPU is
+// about to execute `stop_pc`. The frame end is placed so that overshoot
+// from a long final instruction is paid back next frame. Inlined so the
+// plain frame loop doesn't pay for the check.
+static inline __attribute__((always_inline)) bool
+run_frame(Gba *gba, bool stop, u32 stop_pc) {
+  Scheduler *scheduler = &gba->scheduler;
+
+  uint start_time = scheduler->current_time;
+  scheduler_push_event(scheduler, EVENT_TYPE_FRAME_END,
+                       CYCLES_PER_FRAME - gba->frame_overshoot);
+
+  bool frame_done = false;
+
+  while (!frame_done) {
+
+    while ((int)(scheduler->current_time -
+                 scheduler_peek_next_event_time(scheduler)) >= 0) {
+
+      Event event;
+      if (!scheduler_pop_event(scheduler, &event)) {
+        break;
+      }
+      uint lateness = scheduler->current_time - event.scheduled_time;
+      switch (event.type) {
+      case EVENT_TYPE_FRAME_END:
+        frame_done = true;
+        break;
+
+      case EVENT_TYPE_HBLANK_START:
+        ppu_hblank_start(gba, lateness);
+        break;
+      case EVENT_TYPE_HBLANK_END:
+        ppu_hblank_end(gba, lateness);
+        break;
+      case EVENT_TYPE_VBLANK_HBLANK_START:
+        ppu_vblank_hblank_start(gba, lateness);
+        break;
+      case EVENT_TYPE_VBLANK_HBLANK_END:
+        ppu_vblank_hblank_end(gba, lateness);
+        break;
+      case EVENT_TYPE_TIMER_OVERFLOW:
+        timer_overflow(gba, event.ctx, lateness);
+        break;
+      case EVENT_TYPE_DMA_ACTIVATE:
+        dma_transfer(gba, event.ctx);
+        break;
+      case EVENT_TYPE_IRQ:
+        handle_interrupts(gba);
+        break;
+      case EVENT_TYPE_APU_SEQUENCER:
+        psg_sequencer_step(gba, lateness);
+        break;
+      }
+      if (frame_done) {
+        break;
+      }
+    }
+
+    if (gba->io.power_state == POWER_STATE_HALTED) {
+      int next_event_time = scheduler_peek_next_event_time(scheduler);
+      scheduler_step(scheduler, next_event_time - scheduler->current_time);
+    } else {
+      if (stop && gba->cpu.regs[15] - ((gba->cpu.cpsr & CPSR_T) ? 4 : 8) ==
+                      stop_pc) {
+        // Mid-frame: the next frame ends where this one would have.
+        scheduler_cancel_event(scheduler, EVENT_TYPE_FRAME_END, 0);
+        gba->frame_overshoot += scheduler->current_time - start_time;
+        return true;
+      }
+      cpu_step(gba);
+    }
+  }
+
+  gba->frame_overshoot += scheduler->current_time - start_time;
+  gba->frame_overshoot -= CYCLES_PER_FRAME;
+  return false;
+}
+
+void gba_run_frame(Gba *gba) { run_frame(gba, false, 0); }
+
+// Runs until the CPU is about to execute `pc`, for at most `max_frames`
+// frames. Returns whether it got there.
+bool gba_run_to_pc(Gba *gba, u32 pc, int max_frames) {
+  for (int i = 0; i < max_frames; i++) {
+    if (run_frame(gba, true, pc)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void gba_snapshot(Gba *gba, void *state) {
+  memcpy(state, gba, GBA_STATE_SIZE);
+}
+
+// The memories the dirty map covers, in state order. The BIOS is never
+// written, so it's left to the full snapshot.
+static const struct {
+  int region; // DirtyRegion, or -1 for memory that never changes
+  size_t offset;
+  size_t size;
+} tracked[] = {
+    {-1, offsetof(Gba, bios), sizeof(((Gba *)0)->bios)},
+    {DIRTY_PALETTE, offsetof(Gba, ppu.palram), sizeof(((Ppu *)0)->palram)},
+    {DIRTY_VRAM, offsetof(Gba, ppu.vram), sizeof(((Ppu *)0)->vram)},
+    {DIRTY_OAM, offsetof(Gba, ppu.oam), sizeof(((Ppu *)0)->oam)},
+    {DIRTY_EWRAM, offsetof(Gba, ewram), sizeof(((Gba *)0)->ewram)},
+    {DIRTY_IWRAM, offsetof(Gba, iwram), sizeof(((Gba *)0)->iwram)},
+    {DIRTY_BACKUP, offsetof(Gba, backup.data), sizeof(((Backup *)0)->data)},
+};
+
+void gba_changed_ranges(Gba *gba, GbaRangeFn fn, void *ctx) {
+  size_t pos = 0;
+  for (size_t i = 0; i < sizeof(tracked) / sizeof(tracked[0]); i++) {
+    // Everything between the tracked memories is passed whole.
+    if (tracked[i].offset > pos) {
+      fn(ctx, pos, tracked[i].offset - pos);
+    }
+    pos = tracked[i].offset + tracked[i].size;
+    if (tracked[i].region < 0) {
+      continue;
+    }
+    int page = dirty_next(&gba->dirty, tracked[i].region, 0);
+    while (page >= 0) {
+      int last = page;
+      while (dirty_next(&gba->dirty, tracked[i].region, last + 1) == last + 1) {
+        last++;
+      }
+      size_t start = (size_t)page << DIRTY_PAGE_SHIFT;
+      size_t end = MIN((size_t)(last + 1) << DIRTY_PAGE_SHIFT, tracked[i].size);
+      fn(ctx, tracked[i].offset + start, end - start);
+      page = dirty_next(&gba->dirty, tracked[i].region, last + 1);
+    }
+  }
+  fn(ctx, pos, GBA_STATE_SIZE - pos);
+}
+
+typedef struct {
+  const u8 *src;
+  u8 *dest;
+  size_t copied;
+} CopyRanges;
+
+static void copy_range(void *ctx, size_t offset, size_t size) {
+  CopyRanges *copy = ctx;
+  memcpy(copy->dest + offset, copy->src + offset, size);
+  copy->copied += size;
+}
+
+// Brings `state` up to date, copying only what changed since the dirty
+// map was last cleared, then clears it. `state` must be what this instance
+// looked like at that point, e.g. a gba_snapshot taken right before
+// clearing the map. Returns the bytes copied.
+size_t gba_snapshot_incremental(Gba *gba, void *state) {
+  CopyRanges copy = {(const u8 *)gba, state, 0};
+  gba_changed_ranges(gba, copy_range, &copy);
+  dirty_clear(&gba->dirty);
+  return copy.copied;
+}
+
+void gba_restore(Gba *gba, const void *state) {
+  memcpy(gba, state, GBA_STATE_SIZE);
+  gba->palette_dirty = true;
+  gba->unsaved = (BackupRange){0, gba->backup.size};
+  dirty_mark_all(&gba->dirty);
+}
+
+// The clone shares the source's ROM, which must outlive it, and renders to
+// its own framebuffer.
+void gba_clone(Gba *dest, Gba *src) {
+  memcpy(dest, src, GBA_STATE_SIZE);
+  dest->rom = src->rom;
+  dest->rom.owned = false;
+  dest->video_output = NULL;
+  dest->video_pitch = 0;
+  dest->skip_video = false;
+  dest->video_format = src->video_format;
+  dest->palette_dirty = true;
+  dest->synthesize = src->synthesize;
+  dest->audio.read = dest->audio.write = 0;
+  dest->unsaved = (BackupRange){0, dest->backup.size};
+  dirty_mark_all(&dest->dirty);
+}
+
+// Emulates `frames` frames past the current one without sound, rendering
+// only the last, then returns to the current state. The frontend shows the
+// result, hiding that many frames of the game's own input lag. `scratch`
+// holds GBA_STATE_SIZE bytes.
+void gba_run_ahead(Gba *gba, int frames, void *scratch) {
+  if (frames <= 0) {
+    return;
+  }
+  gba_snapshot(gba, scratch);
+  // What the hidden frames wrote is undone, so what was dirty before is
+  // exactly what's dirty after.
+  DirtyMap dirty = gba->dirty;
+  BackupRange unsaved = gba->unsaved;
+  bool synthesize = gba->synthesize;
+  apu_set_synthesize(gba, false);
+  for (int i = 0; i < frames; i++) {
+    ppu_set_skip_video(gba, i < frames - 1);
+    gba_run_frame(gba);
+  }
+  ppu_set_skip_video(gba, false);
+  if (!gba->video_output) {
+    // The internal framebuffer is part of the state; keep the frame shown.
+    memcpy((u8 *)scratch + offsetof(Gba, ppu.framebuffer),
+           gba->ppu.framebuffer, sizeof(gba->ppu.framebuffer));
+  }
+  gba_restore(gba, scratch);
+  gba->dirty = dirty;
+  gba->unsaved = unsaved;
+  gba->synthesize = synthesize;
 }
 
 bool load_bios(u8 *bios, const char *bios_path) {
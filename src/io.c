@@ -17,10 +17,18 @@ void io_init(Io *io) {
 
 u8 io_read8(Gba *gba, u32 addr) {
   Ppu *ppu = &gba->ppu;
+  Apu *apu = &gba->apu;
   Keypad *keypad = &gba->keypad;
   Io *io = &gba->io;
   InterruptManager *int_mgr = &gba->int_mgr;
 
+  if (addr >= SOUND1CNT_L && addr < SOUNDCNT_H) {
+    return psg_read8(gba, addr);
+  }
+  if (addr >= WAVE_RAM0_L && addr < FIFO_A_L) {
+    return psg_wave_read8(gba, addr);
+  }
+
   switch (addr) {
   case DISPCNT:
     return ppu->Lcd.dispcnt.val & 0xFF;
@@ -67,6 +75,18 @@ u8 io_read8(Gba *gba, u32 addr) {
   case BLDCNT + 1:
     return (ppu->Lcd.blendcnt.val >> 8) & 0xFF;
 
+  /* Sound */
+  case SOUNDCNT_H:
+    return apu->soundcnt_h & 0xFF;
+  case SOUNDCNT_H + 1:
+    return (apu->soundcnt_h >> 8) & 0xFF;
+  case SOUNDCNT_X:
+    return apu->soundcnt_x | psg_status(&apu->psg);
+  case SOUNDBIAS:
+    return apu->soundbias & 0xFF;
+  case SOUNDBIAS + 1:
+    return (apu->soundbias >> 8) & 0xFF;
+
   /* Keypad */
   case KEYINPUT:
     return keypad->keyinput & 0xFF;
@@ -94,6 +114,8 @@ u8 io_read8(Gba *gba, u32 addr) {
     return io->waitcnt & 0xFF;
   case WAITCNT + 1:
     return (io->waitcnt >> 8) & 0xFF;
+  case POSTFLG:
+    return io->postflg;
   default:
     // printf("unhandled io read: %08X\n", addr);
     return 0;
@@ -144,10 +166,20 @@ u32 io_read32(Gba *gba, u32 addr) {
 
 void io_write8(Gba *gba, u32 addr, u8 val) {
   Ppu *ppu = &gba->ppu;
+  Apu *apu = &gba->apu;
   Keypad *keypad = &gba->keypad;
   Io *io = &gba->io;
   InterruptManager *int_mgr = &gba->int_mgr;
 
+  if (addr >= SOUND1CNT_L && addr < SOUNDCNT_H) {
+    psg_write8(gba, addr, val);
+    return;
+  }
+  if (addr >= WAVE_RAM0_L && addr < FIFO_A_L) {
+    psg_wave_write8(gba, addr, val);
+    return;
+  }
+
   switch (addr) {
   case DISPCNT:
     ppu->Lcd.dispcnt.val = (ppu->Lcd.dispcnt.val & 0xFF00) | val;
@@ -381,6 +413,37 @@ void io_write8(Gba *gba, u32 addr, u8 val) {
   case BLDY + 1:
     break;
 
+  /* Sound */
+  case SOUNDCNT_H:
+    apu_soundcnt_h_write(gba, (apu->soundcnt_h & 0xFF00) | val);
+    break;
+  case SOUNDCNT_H + 1:
+    apu_soundcnt_h_write(gba, (apu->soundcnt_h & 0x00FF) | (val << 8));
+    break;
+  case SOUNDCNT_X:
+    apu_soundcnt_x_write(gba, val);
+    break;
+  case SOUNDBIAS:
+    apu_sync(gba);
+    apu->soundbias = (apu->soundbias & 0xFF00) | val;
+    break;
+  case SOUNDBIAS + 1:
+    apu_sync(gba);
+    apu->soundbias = (apu->soundbias & 0x00FF) | (val << 8);
+    break;
+  case FIFO_A_L:
+  case FIFO_A_L + 1:
+  case FIFO_A_H:
+  case FIFO_A_H + 1:
+    apu_fifo_write(gba, 0, val);
+    break;
+  case FIFO_B:
+  case FIFO_B + 1:
+  case FIFO_B_H:
+  case FIFO_B_H + 1:
+    apu_fifo_write(gba, 1, val);
+    break;
+
   /* Keypad */
   case KEYCNT:
     keypad->keycnt = (keypad->keycnt & 0xFF00) | val;
@@ -421,6 +484,9 @@ void io_write8(Gba *gba, u32 addr, u8 val) {
     }
     break;
 
+  case POSTFLG:
+    io->postflg = val & 1;
+    break;
   case HALTCNT:
     if (TEST_BIT(val, 7)) {
       io->power_state = POWER_STATE_STOPPED;
@@ -441,7 +507,6 @@ void io_write16(Gba *gba, u32 addr, u16 val) {
   Io *io = &gba->io;
   Keypad *keypad = &gba->keypad;
   Dma *dma = &gba->dma;
-  TimerManager *tmr_mgr = &gba->tmr_mgr;
 
   switch (addr) {
   // LCD
@@ -483,7 +548,11 @@ void io_write16(Gba *gba, u32 addr, u16 val) {
     break;
 
   // Sound
+  case SOUNDCNT_H:
+    apu_soundcnt_h_write(gba, val);
+    break;
   case SOUNDBIAS:
+    apu_sync(gba);
     apu->soundbias = val;
     break;
 
@@ -547,7 +616,7 @@ void io_write16(Gba *gba, u32 addr, u16 val) {
   case TM2CNT_L:
   case TM3CNT_L: {
     int tmr = (addr - TM0CNT_L) / 4;
-    tmr_mgr->timers[tmr].reload_count = val;
+    timer_reload_write(gba, tmr, val);
     break;
   }
   case TM0CNT_H:
@@ -0,0 +1,183 @@
+#include "lz.h"
+#include <string.h>
+
+#define HASH_BITS 14
+#define MIN_MATCH 4
+#define MAX_OFFSET 0xFFFF
+
+// The last bytes are always emitted as literals, which keeps the match
+// search from reading past the end of the input.
+#define TAIL_LITERALS 8
+
+static inline u32 read32(const u8 *p) {
+  u32 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline u64 read64(const u8 *p) {
+  u64 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline u32 hash(u32 v) { return (v * 2654435761u) >> (32 - HASH_BITS); }
+
+static u8 *write_length(u8 *out, size_t len) {
+  while (len >= 255) {
+    *out++ = 255;
+    len -= 255;
+  }
+  *out++ = len;
+  return out;
+}
+
+// Emits one sequence: a token, the literal run, then the match (if any).
+static u8 *write_sequence(u8 *out, const u8 *literals, size_t literal_len,
+                          size_t offset, size_t match_len) {
+  u8 *token = out++;
+  *token = MIN(literal_len, 15) << 4;
+  if (literal_len >= 15) {
+    out = write_length(out, literal_len - 15);
+  }
+  memcpy(out, literals, literal_len);
+  out += literal_len;
+
+  if (match_len == 0) {
+    return out;
+  }
+
+  *out++ = offset & 0xFF;
+  *out++ = offset >> 8;
+  match_len -= MIN_MATCH;
+  *token |= MIN(match_len, 15);
+  if (match_len >= 15) {
+    out = write_length(out, match_len - 15);
+  }
+  return out;
+}
+
+// Length of the common prefix of `a` and `b`, not reading at or past `limit`.
+static size_t match_length(const u8 *a, const u8 *b, const u8 *limit) {
+  const u8 *start = a;
+  while (a + 8 <= limit) {
+    u64 diff = read64(a) ^ read64(b);
+    if (diff) {
+      return a - start + __builtin_ctzll(diff) / 8;
+    }
+    a += 8;
+    b += 8;
+  }
+  while (a < limit && *a == *b) {
+    a++;
+    b++;
+  }
+  return a - start;
+}
+
+size_t lz_compress(const u8 *src, size_t size, u8 *dest) {
+  u32 table[1 << HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  const u8 *end = src + size;
+  const u8 *limit = size > TAIL_LITERALS ? end - TAIL_LITERALS : src;
+  const u8 *ip = src;
+  const u8 *anchor = src;
+  u8 *op = dest;
+
+  // Incompressible stretches are skipped faster the longer they get.
+  u32 misses = 0;
+
+  while (ip + MIN_MATCH <= limit) {
+    u32 seq = read32(ip);
+    u32 h = hash(seq);
+    const u8 *ref = src + table[h];
+    table[h] = ip - src;
+
+    if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+      ip += 1 + (misses++ >> 6);
+      continue;
+    }
+    misses = 0;
+
+    size_t len =
+        MIN_MATCH + match_length(ip + MIN_MATCH, ref + MIN_MATCH, limit);
+    op = write_sequence(op, anchor, ip - anchor, ip - ref, len);
+    ip += len;
+    anchor = ip;
+  }
+
+  op = write_sequence(op, anchor, end - anchor, 0, 0);
+  return op - dest;
+}
+
+static bool read_length(const u8 **ip, const u8 *end, size_t *len) {
+  u8 byte;
+  do {
+    if (*ip >= end) {
+      return false;
+    }
+    byte = *(*ip)++;
+    *len += byte;
+  } while (byte == 255);
+  return true;
+}
+
+bool lz_decompress(const u8 *src, size_t size, u8 *dest, size_t dest_size) {
+  const u8 *ip = src;
+  const u8 *end = src + size;
+  u8 *op = dest;
+  u8 *op_end = dest + dest_size;
+
+  while (ip < end) {
+    u8 token = *ip++;
+
+    size_t literal_len = token >> 4;
+    if (literal_len == 15 && !read_length(&ip, end, &literal_len)) {
+      return false;
+    }
+    if (literal_len > (size_t)(end - ip) ||
+        literal_len > (size_t)(op_end - op)) {
+      return false;
+    }
+    memcpy(op, ip, literal_len);
+    ip += literal_len;
+    op += literal_len;
+
+    // The last sequence has no match.
+    if (ip == end) {
+      break;
+    }
+
+    if (end - ip < 2) {
+      return false;
+    }
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dest)) {
+      return false;
+    }
+
+    size_t match_len = token & 15;
+    if (match_len == 15 && !read_length(&ip, end, &match_len)) {
+      return false;
+    }
+    match_len += MIN_MATCH;
+    if (match_len > (size_t)(op_end - op)) {
+      return false;
+    }
+
+    // Overlapping matches repeat a period of `offset` bytes; copy it in
+    // doubling chunks so long runs don't go byte by byte.
+    const u8 *match = op - offset;
+    size_t copied = 0;
+    while (copied < match_len) {
+      size_t chunk = MIN(offset + copied, match_len - copied);
+      memcpy(op + copied, match, chunk);
+      copied += chunk;
+    }
+    op += match_len;
+  }
+
+  return op == op_end;
+}
@@ -1,15 +1,67 @@
+#include "apu.h"
+#include "audio_ring.h"
 #include "common.h"
 #include "cpu.h"
 #include "gba.h"
 #include "interrupt.h"
 #include "io.h"
 #include "keypad.h"
+#include "movie.h"
 #include "ppu.h"
+#include "resampler.h"
+#include "rewind.h"
+#include "savefile.h"
+#include "savestate.h"
 #include "scheduler.h"
 #include <SDL.h>
 #include <stdint.h>
+#include <string.h>
+
+#define AUDIO_OUTPUT_RATE 48000
+
+// With an audio device, emulation is paced by it: a new frame is not started
+// while the ring holds more than the target latency. The resampling ratio is
+// nudged to keep the fill there so pacing never has to drop audio.
+#define AUDIO_TARGET_LATENCY_MS 50
+#define AUDIO_RING_LATENCY_MS 250
+#define AUDIO_MAX_ADJUST 0.005
+
+// Run-ahead emulates this many frames past each real one and shows the last,
+// at the cost of running that many more frames per frame.
+#define MAX_RUN_AHEAD 4
+
+// Rewind keeps a snapshot every other frame in a fixed budget, which is a
+// few minutes of typical play.
+#define REWIND_INTERVAL 2
+#define REWIND_BUDGET (64 * 1024 * 1024)
+
+static Resampler resampler;
+static AudioRing audio_ring;
+static Rewind rewind_buffer;
 
 bool turbo = false;
+bool rewinding = false;
+
+// F5 saves and F7 loads a single state slot next to the ROM.
+static char state_path[4096];
+
+// Backup memory lives in <rom>.sav.
+static char save_path[4096];
+static SaveFile save_file;
+
+// F8 starts and stops recording an input movie next to the ROM.
+static char movie_path[4096];
+static Movie movie;
+static bool recording = false;
+
+// Anything that jumps the state breaks the recording, so it ends there.
+static void stop_recording(void) {
+  if (recording) {
+    movie_save(&movie, movie_path);
+    movie_free(&movie);
+    recording = false;
+  }
+}
 
 bool handle_input(Gba *gba) {
   SDL_Event event;
@@ -22,6 +74,25 @@ bool handle_input(Gba *gba) {
       case SDLK_TAB:
         turbo = true;
         break;
+      case SDLK_r:
+        rewinding = true;
+        break;
+      case SDLK_F5:
+        gba_save_state(gba, state_path);
+        break;
+      case SDLK_F7:
+        stop_recording();
+        if (gba_load_state(gba, state_path)) {
+          rewind_reset(&rewind_buffer);
+        }
+        break;
+      case SDLK_F8:
+        if (recording) {
+          stop_recording();
+        } else {
+          recording = movie_record_start(&movie, gba);
+        }
+        break;
       case SDLK_UP:
         gba->keypad.keyinput &= ~(1 << BUTTON_UP);
         break;
@@ -59,6 +130,9 @@ bool handle_input(Gba *gba) {
       case SDLK_TAB:
         turbo = false;
         break;
+      case SDLK_r:
+        rewinding = false;
+        break;
       case SDLK_UP:
         gba->keypad.keyinput |= (1 << BUTTON_UP);
         break;
@@ -96,8 +170,48 @@ bool handle_input(Gba *gba) {
   return false;
 }
 
+static void audio_callback(void *userdata, Uint8 *stream, int len) {
+  static s16 last[2];
+  AudioRing *ring = userdata;
+  s16 *dest = (s16 *)stream;
+  u32 frames = len / (2 * sizeof(s16));
+
+  u32 read = audio_ring_read(ring, dest, frames);
+  if (read > 0) {
+    last[0] = dest[read * 2 - 2];
+    last[1] = dest[read * 2 - 1];
+  }
+  // On underrun hold the last frame rather than clicking to silence.
+  for (u32 i = read; i < frames; i++) {
+    dest[i * 2] = last[0];
+    dest[i * 2 + 1] = last[1];
+  }
+}
+
+// Blocks until the audio device has drained the ring down to `target`.
+static void wait_for_audio(AudioRing *ring, u32 target, int rate) {
+  u32 fill;
+  while ((fill = audio_ring_fill(ring)) > target) {
+    SDL_Delay(MAX(1, (fill - target) * 1000 / rate));
+  }
+}
+
+// High-resolution pacing for runs without audio. SDL_Delay has millisecond
+// granularity, so it sleeps to within a millisecond and yields the rest.
+static void sleep_until(Uint64 deadline) {
+  Uint64 freq = SDL_GetPerformanceFrequency();
+  while (true) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (now >= deadline) {
+      return;
+    }
+    Uint64 remaining_ms = (deadline - now) * 1000 / freq;
+    SDL_Delay(remaining_ms >= 2 ? remaining_ms - 1 : 0);
+  }
+}
+
 int main(int argc, char *argv[]) {
-  if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+  if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
     return 1;
   }
 
@@ -117,143 +231,231 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  SDL_Texture *texture =
-      SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                        SDL_TEXTUREACCESS_STREAMING, 240, 160);
-  if (!texture) {
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
-    return 1;
+  // Frames are rendered straight into a locked texture. Two are used so the
+  // next frame never has to wait for the one being presented.
+  SDL_Texture *textures[2];
+  for (int i = 0; i < 2; i++) {
+    textures[i] = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                    SDL_TEXTUREACCESS_STREAMING, 240, 160);
+    if (!textures[i]) {
+      if (i > 0) {
+        SDL_DestroyTexture(textures[0]);
+      }
+      SDL_DestroyRenderer(renderer);
+      SDL_DestroyWindow(window);
+      SDL_Quit();
+      return 1;
+    }
   }
+  int back = 0;
 
+  char *rom_file = NULL;
   char *bios_file = "gba_bios.bin";
-  if (argc == 3) {
-    bios_file = argv[2];
-  } else if (argc != 2) {
-    printf("Usage: %s <rom_file> [bios_file]\n", argv[0]);
-    SDL_DestroyTexture(texture);
+  int run_ahead = 0;
+  bool fast_boot = false;
+  int positional = 0;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--run-ahead=", 12) == 0) {
+      run_ahead = atoi(argv[i] + 12);
+      usage |= run_ahead < 0 || run_ahead > MAX_RUN_AHEAD;
+    } else if (strcmp(argv[i], "--fast-boot") == 0) {
+      fast_boot = true;
+    } else if (argv[i][0] == '-') {
+      usage = true;
+    } else if (positional == 0) {
+      rom_file = argv[i];
+      positional++;
+    } else if (positional == 1) {
+      bios_file = argv[i];
+      positional++;
+    } else {
+      usage = true;
+    }
+  }
+  if (usage || !rom_file) {
+    printf("Usage: %s [--run-ahead=N] [--fast-boot] <rom_file> [bios_file]\n",
+           argv[0]);
+    SDL_DestroyTexture(textures[0]);
+    SDL_DestroyTexture(textures[1]);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
     return 1;
   }
 
+  snprintf(state_path, sizeof(state_path), "%s.ss0", rom_file);
+  snprintf(movie_path, sizeof(movie_path), "%s.mov", rom_file);
+  snprintf(save_path, sizeof(save_path), "%s.sav", rom_file);
+
   Gba *gba = malloc(sizeof(Gba));
-  if (!gba_init(gba, bios_file, argv[1])) {
+  if (!gba_init(gba, bios_file, rom_file)) {
     gba_free(gba);
     free(gba);
-    SDL_DestroyTexture(texture);
+    SDL_DestroyTexture(textures[0]);
+    SDL_DestroyTexture(textures[1]);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
     return 1;
   }
+  if (fast_boot) {
+    gba_skip_bios(gba);
+  }
+  savefile_open(&save_file, gba, save_path);
 
-  Uint32 frame_start_time = SDL_GetTicks();
+  SDL_AudioSpec audio_spec = {0};
+  audio_spec.freq = AUDIO_OUTPUT_RATE;
+  audio_spec.format = AUDIO_S16SYS;
+  audio_spec.channels = 2;
+  audio_spec.samples = 512;
+  audio_spec.callback = audio_callback;
+  audio_spec.userdata = &audio_ring;
+  SDL_AudioSpec audio_have;
+  SDL_AudioDeviceID audio =
+      SDL_OpenAudioDevice(NULL, 0, &audio_spec, &audio_have,
+                          SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+  if (audio && !audio_ring_init(&audio_ring, audio_have.freq *
+                                                 AUDIO_RING_LATENCY_MS / 1000)) {
+    SDL_CloseAudioDevice(audio);
+    audio = 0;
+  }
+  s16 *resampled = NULL;
+  u32 audio_target = 0;
+  if (audio) {
+    resampler_init(&resampler, APU_SAMPLE_RATE, audio_have.freq);
+    // Twice the nominal bound leaves room for any rate adjustment.
+    resampled = malloc(resampler_max_output(&resampler, APU_BUFFER_SIZE) * 2 *
+                       2 * sizeof(s16));
+    audio_target = audio_have.freq * AUDIO_TARGET_LATENCY_MS / 1000;
+    SDL_PauseAudioDevice(audio, 0);
+  } else {
+    // Nothing to play the samples on, so don't generate them.
+    apu_set_synthesize(gba, false);
+  }
+
+  u8 *run_ahead_state = NULL;
+  if (run_ahead > 0) {
+    run_ahead_state = malloc(GBA_STATE_SIZE);
+  }
+
+  bool rewind_enabled =
+      rewind_init(&rewind_buffer, REWIND_INTERVAL, REWIND_BUDGET);
+
+  Uint64 frame_period = SDL_GetPerformanceFrequency() * CYCLES_PER_FRAME /
+                        (16 * 1024 * 1024);
+  Uint64 next_frame = SDL_GetPerformanceCounter();
 
   int frame_count = 0;
-  Uint32 last_time = frame_start_time;
+  Uint32 last_time = SDL_GetTicks();
   char fps_buffer[32];
 
-  int total_cycles = 0;
   while (true) {
 
     if (handle_input(gba)) {
       goto shutdown;
     }
 
-    Scheduler *scheduler = &gba->scheduler;
-
-    uint start_time = scheduler->current_time;
-    scheduler_push_event(scheduler, EVENT_TYPE_FRAME_END,
-                         CYCLES_PER_FRAME - total_cycles);
-
-    bool frame_done = false;
-
-    while (!frame_done) {
-
-      while ((int)(scheduler->current_time -
-                   scheduler_peek_next_event_time(scheduler)) >= 0) {
-
-        Event *event = scheduler_pop_event(scheduler);
-        if (!event) {
-          break;
-        }
-        uint lateness = scheduler->current_time - event->scheduled_time;
-        switch (event->type) {
-        case EVENT_TYPE_FRAME_END:
-          frame_done = true;
-          break;
-
-        case EVENT_TYPE_HBLANK_START:
-          ppu_hblank_start(gba, lateness);
-          break;
-        case EVENT_TYPE_HBLANK_END:
-          ppu_hblank_end(gba, lateness);
-          break;
-        case EVENT_TYPE_VBLANK_HBLANK_START:
-          ppu_vblank_hblank_start(gba, lateness);
-          break;
-        case EVENT_TYPE_VBLANK_HBLANK_END:
-          ppu_vblank_hblank_end(gba, lateness);
-          break;
-        case EVENT_TYPE_TIMER_OVERFLOW:
-          timer_overflow(gba, (int)(intptr_t)event->ctx, lateness);
-          break;
-        case EVENT_TYPE_DMA_ACTIVATE:
-          dma_transfer(gba, (int)(intptr_t)event->ctx);
-          break;
-        case EVENT_TYPE_IRQ:
-          handle_interrupts(gba);
-          break;
-        }
-        free(event);
-        if (frame_done) {
-          break;
-        }
-      }
+    SDL_Texture *texture = textures[back];
+    void *pixels;
+    int pitch;
+    bool locked = SDL_LockTexture(texture, NULL, &pixels, &pitch) == 0;
+    if (locked) {
+      ppu_set_output(gba, pixels, pitch);
+    } else {
+      ppu_set_output(gba, NULL, 0);
+    }
 
-      if (gba->io.power_state == POWER_STATE_HALTED) {
-        int next_event_time = scheduler_peek_next_event_time(scheduler);
-        scheduler_step(scheduler, next_event_time - scheduler->current_time);
+    // While rewinding, each frame steps back one snapshot and replays a
+    // frame from it to have something to show.
+    if (rewind_enabled) {
+      u16 keyinput = gba->keypad.keyinput;
+      if (rewinding && rewind_step(&rewind_buffer, gba)) {
+        // Keep the keys actually held rather than the snapshot's.
+        gba->keypad.keyinput = keyinput;
+        stop_recording();
       } else {
-        cpu_step(gba);
+        rewind_capture(&rewind_buffer, gba);
       }
     }
+    if (recording) {
+      movie_record_frame(&movie, gba);
+    }
+    // With run-ahead the real frame is never shown, only its sound is.
+    ppu_set_skip_video(gba, run_ahead_state != NULL);
+    gba_run_frame(gba);
+    ppu_set_skip_video(gba, false);
 
-    total_cycles += scheduler->current_time - start_time;
-
-    total_cycles -= CYCLES_PER_FRAME;
+    apu_sync(gba);
+    s16 samples[APU_BUFFER_SIZE * 2];
+    int sample_frames = apu_read_samples(gba, samples, APU_BUFFER_SIZE);
+    if (run_ahead_state) {
+      gba_run_ahead(gba, run_ahead, run_ahead_state);
+    }
+    savefile_sync(&save_file, gba);
+    if (audio) {
+      u32 fill = audio_ring_fill(&audio_ring);
+      double error = ((double)fill - audio_target) / audio_target;
+      error = MAX(-1.0, MIN(error, 1.0));
+      resampler_set_adjust(&resampler, 1.0 + error * AUDIO_MAX_ADJUST);
 
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
+      int out_frames =
+          resampler_process(&resampler, samples, sample_frames, resampled);
+      audio_ring_write(&audio_ring, resampled, out_frames);
+    }
 
-    SDL_UpdateTexture(texture, NULL, gba->ppu.framebuffer, 240 * sizeof(u32));
+    if (locked) {
+      SDL_UnlockTexture(texture);
+    } else {
+      SDL_UpdateTexture(texture, NULL, gba->ppu.framebuffer,
+                        240 * sizeof(u32));
+    }
     SDL_RenderCopy(renderer, texture, NULL, NULL);
 
     SDL_RenderPresent(renderer);
+    back ^= 1;
 
-    Uint32 frame_time = SDL_GetTicks() - frame_start_time;
-    if (!turbo && frame_time < FRAME_TIME_MS) {
-      SDL_Delay(FRAME_TIME_MS - frame_time);
+    if (!turbo) {
+      if (audio) {
+        wait_for_audio(&audio_ring, audio_target, audio_have.freq);
+      } else {
+        Uint64 now = SDL_GetPerformanceCounter();
+        next_frame += frame_period;
+        // Don't try to catch up after a stall or turbo.
+        if (now > next_frame + frame_period) {
+          next_frame = now;
+        }
+        sleep_until(next_frame);
+      }
     }
 
-    frame_start_time = SDL_GetTicks();
-
     frame_count++;
-    Uint32 elapsed_time = frame_start_time - last_time;
+    Uint32 now = SDL_GetTicks();
+    Uint32 elapsed_time = now - last_time;
     if (elapsed_time >= 1000) {
       double fps = (double)frame_count * 1000.0 / elapsed_time;
       snprintf(fps_buffer, sizeof(fps_buffer), "gba-emu | FPS: %.1f", fps);
       SDL_SetWindowTitle(window, fps_buffer);
       frame_count = 0;
-      last_time = frame_start_time;
+      last_time = now;
     }
   }
 
 shutdown:
-  SDL_DestroyTexture(texture);
+  stop_recording();
+  savefile_sync(&save_file, gba);
+  savefile_close(&save_file);
+  if (rewind_enabled) {
+    rewind_free(&rewind_buffer);
+  }
+  if (audio) {
+    SDL_CloseAudioDevice(audio);
+    audio_ring_free(&audio_ring);
+  }
+  free(resampled);
+  free(run_ahead_state);
+  SDL_DestroyTexture(textures[0]);
+  SDL_DestroyTexture(textures[1]);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
@@ -0,0 +1,173 @@
+#include "movie.h"
+#include "crc32.h"
+#include "gba.h"
+#include "savestate.h"
+#include <string.h>
+
+#define MAGIC "GBAMOVIE"
+#define MAGIC_SIZE 8
+#define HEADER_SIZE (MAGIC_SIZE + 24)
+#define EVENT_SIZE 6
+
+static u32 rom_crc(Gba *gba) { return gba->rom.info.crc; }
+
+static u32 bios_crc(Gba *gba) {
+  return crc32(0, gba->bios, sizeof(gba->bios));
+}
+
+bool movie_record_start(Movie *movie, Gba *gba) {
+  memset(movie, 0, sizeof(Movie));
+  movie->rom_crc = rom_crc(gba);
+  movie->bios_crc = bios_crc(gba);
+
+  movie->state = malloc(savestate_bound());
+  if (!movie->state) {
+    return false;
+  }
+  movie->state_size = savestate_save(gba, movie->state);
+  movie->keyinput = gba->keypad.keyinput;
+  return true;
+}
+
+void movie_record_frame(Movie *movie, Gba *gba) {
+  u16 keyinput = gba->keypad.keyinput;
+  if (keyinput != movie->keyinput) {
+    if (movie->event_count == movie->event_capacity) {
+      u32 capacity = MAX(movie->event_capacity * 2, 256);
+      MovieEvent *events =
+          realloc(movie->events, capacity * sizeof(MovieEvent));
+      if (!events) {
+        printf("Out of memory recording movie, input dropped\n");
+        return;
+      }
+      movie->events = events;
+      movie->event_capacity = capacity;
+    }
+    movie->events[movie->event_count++] =
+        (MovieEvent){movie->frame_count, keyinput};
+    movie->keyinput = keyinput;
+  }
+  movie->frame_count++;
+}
+
+bool movie_play_start(Movie *movie, Gba *gba) {
+  if (movie->rom_crc != rom_crc(gba)) {
+    printf("Movie was recorded with a different ROM\n");
+    return false;
+  }
+  if (movie->bios_crc != bios_crc(gba)) {
+    printf("Movie was recorded with a different BIOS\n");
+    return false;
+  }
+  if (!savestate_load(gba, movie->state, movie->state_size)) {
+    return false;
+  }
+  movie->frame = 0;
+  movie->cursor = 0;
+  return true;
+}
+
+bool movie_play_frame(Movie *movie, Gba *gba) {
+  if (movie->frame >= movie->frame_count) {
+    return false;
+  }
+  while (movie->cursor < movie->event_count &&
+         movie->events[movie->cursor].frame == movie->frame) {
+    gba->keypad.keyinput = movie->events[movie->cursor].keyinput;
+    movie->cursor++;
+  }
+  movie->frame++;
+  return true;
+}
+
+bool movie_save(Movie *movie, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    printf("Failed to open movie: %s\n", path);
+    return false;
+  }
+
+  u8 header[HEADER_SIZE];
+  memcpy(header, MAGIC, MAGIC_SIZE);
+  put32(header + MAGIC_SIZE, MOVIE_VERSION);
+  put32(header + MAGIC_SIZE + 4, movie->rom_crc);
+  put32(header + MAGIC_SIZE + 8, movie->bios_crc);
+  put32(header + MAGIC_SIZE + 12, movie->frame_count);
+  put32(header + MAGIC_SIZE + 16, movie->event_count);
+  put32(header + MAGIC_SIZE + 20, movie->state_size);
+  bool ok = fwrite(header, 1, HEADER_SIZE, file) == HEADER_SIZE;
+  ok = ok && fwrite(movie->state, 1, movie->state_size, file) ==
+                 movie->state_size;
+
+  for (u32 i = 0; ok && i < movie->event_count; i++) {
+    u8 event[EVENT_SIZE];
+    put32(event, movie->events[i].frame);
+    put16(event + 4, movie->events[i].keyinput);
+    ok = fwrite(event, 1, EVENT_SIZE, file) == EVENT_SIZE;
+  }
+
+  ok &= fclose(file) == 0;
+  if (!ok) {
+    printf("Failed to write movie: %s\n", path);
+  }
+  return ok;
+}
+
+bool movie_load(Movie *movie, const char *path) {
+  memset(movie, 0, sizeof(Movie));
+
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    printf("Failed to open movie: %s\n", path);
+    return false;
+  }
+
+  u8 header[HEADER_SIZE];
+  bool ok = fread(header, 1, HEADER_SIZE, file) == HEADER_SIZE &&
+            memcmp(header, MAGIC, MAGIC_SIZE) == 0 &&
+            get32(header + MAGIC_SIZE) == MOVIE_VERSION;
+  if (ok) {
+    movie->rom_crc = get32(header + MAGIC_SIZE + 4);
+    movie->bios_crc = get32(header + MAGIC_SIZE + 8);
+    movie->frame_count = get32(header + MAGIC_SIZE + 12);
+    movie->event_count = get32(header + MAGIC_SIZE + 16);
+    movie->state_size = get32(header + MAGIC_SIZE + 20);
+    ok = movie->state_size <= savestate_bound() &&
+         movie->event_count <= movie->frame_count;
+  }
+
+  if (ok) {
+    movie->state = malloc(movie->state_size);
+    movie->events = malloc(MAX(movie->event_count, 1) * sizeof(MovieEvent));
+    movie->event_capacity = movie->event_count;
+    ok = movie->state && movie->events &&
+         fread(movie->state, 1, movie->state_size, file) ==
+             movie->state_size;
+  }
+
+  // Events must be in frame order, at most one per frame.
+  for (u32 i = 0; ok && i < movie->event_count; i++) {
+    u8 event[EVENT_SIZE];
+    if (fread(event, 1, EVENT_SIZE, file) != EVENT_SIZE) {
+      ok = false;
+      break;
+    }
+    movie->events[i].frame = get32(event);
+    movie->events[i].keyinput = get16(event + 4);
+    ok = movie->events[i].frame < movie->frame_count &&
+         (i == 0 || movie->events[i].frame > movie->events[i - 1].frame);
+  }
+  fclose(file);
+
+  if (!ok) {
+    printf("Corrupt or incompatible movie: %s\n", path);
+    movie_free(movie);
+  }
+  return ok;
+}
+
+void movie_free(Movie *movie) {
+  free(movie->state);
+  free(movie->events);
+  memset(movie, 0, sizeof(Movie));
+}
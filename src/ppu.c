@@ -5,6 +5,10 @@
 #include <assert.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // [Shape][Size] -> {Width, Height}
 static const int sizes[3][4][2] = {{{8, 8}, {16, 16}, {32, 32}, {64, 64}},
                                    {{16, 8}, {32, 8}, {32, 16}, {64, 32}},
@@ -22,6 +26,14 @@ static inline u32 rgb15_to_argb(u16 color) {
   return 0xFF000000 | (r << 16) | (g << 8) | b;
 }
 
+static inline u8 *output_line(Gba *gba, int y) {
+  if (gba->video_output) {
+    return (u8 *)gba->video_output + y * gba->video_pitch;
+  }
+  int pitch = PIXELS_WIDTH * ppu_bytes_per_pixel(gba->video_format);
+  return (u8 *)gba->ppu.framebuffer + y * pitch;
+}
+
 static void render_obj_reg(Ppu *ppu, ObjAttr *obj,
                            ObjBufferEntry buffer[PIXELS_WIDTH]) {
   u8 *tile_base = ppu->vram + 0x10000;
@@ -324,6 +336,37 @@ static void render_objs(Ppu *ppu, ObjBufferEntry buffer[PIXELS_WIDTH]) {
   }
 }
 
+// Reverses the order of the eight 4-bit pixels in a tile row.
+static inline u32 flip_row_4bpp(u32 row) {
+  row = ((row >> 4) & 0x0F0F0F0F) | ((row & 0x0F0F0F0F) << 4);
+  return __builtin_bswap32(row);
+}
+
+static inline void emit_row_4bpp(u16 *dest, u32 row, const u16 *pal) {
+  for (int k = 0; k < 8; k++) {
+    int color_idx = (row >> (k * 4)) & 0xF;
+    u16 color = pal[color_idx];
+    dest[k] = color_idx ? color : TRANSPARENT;
+  }
+}
+
+static inline void emit_row_8bpp(u16 *dest, u64 row, const u16 *pal) {
+  for (int k = 0; k < 8; k++) {
+    int color_idx = (row >> (k * 8)) & 0xFF;
+    u16 color = pal[color_idx];
+    dest[k] = color_idx ? color : TRANSPARENT;
+  }
+}
+
+static void apply_bg_mosaic(u16 buffer[PIXELS_WIDTH], int mos_h) {
+  for (int x = 0; x < PIXELS_WIDTH; x += mos_h) {
+    int end = MIN(PIXELS_WIDTH, x + mos_h);
+    for (int k = x + 1; k < end; k++) {
+      buffer[k] = buffer[x];
+    }
+  }
+}
+
 static void render_bg_reg(Ppu *ppu, int i, u16 buffer[PIXELS_WIDTH]) {
   if (!ppu->Lcd.dispcnt.enable[i]) {
     return;
@@ -348,60 +391,69 @@ static void render_bg_reg(Ppu *ppu, int i, u16 buffer[PIXELS_WIDTH]) {
   int map_y = (screen_y + ppu->Lcd.bgvofs[i]) % height;
   int block_y = map_y >> 8;
   int tile_y = (map_y & 255) >> 3;
+  int subtile_y = map_y % 8;
 
-  int mos_h = ppu->Lcd.mosaic.bg_h + 1;
+  u16 *map_row = map_base + block_y * (width >> 8) * 1024 + tile_y * 32;
+  u16 *palram = (u16 *)ppu->palram;
 
-  for (int x = 0; x < PIXELS_WIDTH; x++) {
-    int screen_x = x;
-    if (mosaic) {
-      screen_x -= screen_x % mos_h;
-    }
-    int map_x = (screen_x + ppu->Lcd.bghofs[i]) % width;
+  // Whole tiles are emitted into a line padded by one tile on each side, so
+  // the partially visible first and last tiles need no clipping.
+  u16 line[8 + PIXELS_WIDTH + 8];
+
+  int map_x = ppu->Lcd.bghofs[i] % width;
+  int x = -(map_x % 8);
+  map_x -= map_x % 8;
+
+  for (; x < PIXELS_WIDTH; x += 8) {
     int block_x = map_x >> 8;
     int tile_x = (map_x & 255) >> 3;
+    map_x = (map_x + 8) % width;
 
-    u16 entry = map_base[(block_y * (width >> 8) + block_x) * 1024 +
-                         tile_y * 32 + tile_x];
+    u16 entry = map_row[block_x * 1024 + tile_x];
 
     int tile_idx = GET_BITS(entry, 0, 10);
     bool hf = TEST_BIT(entry, 10);
     bool vf = TEST_BIT(entry, 11);
     int pal_bank = GET_BITS(entry, 12, 4);
 
-    int subtile_x = map_x % 8;
-    if (hf) {
-      subtile_x = 7 - subtile_x;
-    }
-
-    int subtile_y = map_y % 8;
-    if (vf) {
-      subtile_y = 7 - subtile_y;
-    }
+    int row_y = vf ? 7 - subtile_y : subtile_y;
+    u16 *dest = line + 8 + x;
 
-    int color_idx;
     if (color_mode) {
-      int tile_addr = tile_base + tile_idx * 64 + subtile_y * 8 + subtile_x;
+      int tile_addr = tile_base + tile_idx * 64 + row_y * 8;
       if (tile_addr >= 0x10000) {
+        for (int k = 0; k < 8; k++) {
+          dest[k] = TRANSPARENT;
+        }
         continue;
       }
-      color_idx = ppu->vram[tile_addr];
+      u64 row = read_mem32(ppu->vram, tile_addr) |
+                (u64)read_mem32(ppu->vram, tile_addr + 4) << 32;
+      if (hf) {
+        row = __builtin_bswap64(row);
+      }
+      emit_row_8bpp(dest, row, palram);
     } else {
-      int tile_addr = tile_base + tile_idx * 32 + subtile_y * 4 + subtile_x / 2;
+      int tile_addr = tile_base + tile_idx * 32 + row_y * 4;
       if (tile_addr >= 0x10000) {
+        for (int k = 0; k < 8; k++) {
+          dest[k] = TRANSPARENT;
+        }
         continue;
       }
-      color_idx = ppu->vram[tile_addr];
-      if (subtile_x % 2) {
-        color_idx >>= 4;
+      u32 row = read_mem32(ppu->vram, tile_addr);
+      if (hf) {
+        row = flip_row_4bpp(row);
       }
-      color_idx &= 0x0F;
+      emit_row_4bpp(dest, row, palram + pal_bank * 16);
     }
+  }
 
-    if (color_idx != 0) {
-      u16 color =
-          ((u16 *)ppu->palram)[color_idx + (!color_mode * (pal_bank * 16))];
-      buffer[x] = color;
-    }
+  memcpy(buffer, line + 8, PIXELS_WIDTH * sizeof(u16));
+
+  int mos_h = ppu->Lcd.mosaic.bg_h + 1;
+  if (mosaic && mos_h > 1) {
+    apply_bg_mosaic(buffer, mos_h);
   }
 }
 
@@ -505,9 +557,7 @@ static void render_mode3(Ppu *ppu, u16 bg_buffers[4][PIXELS_WIDTH]) {
   u16 *buffer = bg_buffers[2];
 
   if (ppu->Lcd.dispcnt.enable[2]) {
-    for (int x = 0; x < PIXELS_WIDTH; x++) {
-      buffer[x] = vram_ptr[x];
-    }
+    memcpy(buffer, vram_ptr, PIXELS_WIDTH * sizeof(u16));
   }
 }
 
@@ -536,9 +586,7 @@ static void render_mode5(Ppu *ppu, u16 bg_buffers[4][PIXELS_WIDTH]) {
       }
       return;
     }
-    for (int x = 0; x < PIXELS_HEIGHT; x++) {
-      buffer[x] = vram_ptr[x];
-    }
+    memcpy(buffer, vram_ptr, PIXELS_HEIGHT * sizeof(u16));
 
     for (int x = PIXELS_HEIGHT; x < PIXELS_WIDTH; x++) {
       buffer[x] = 0x7C1F;
@@ -546,8 +594,226 @@ static void render_mode5(Ppu *ppu, u16 bg_buffers[4][PIXELS_WIDTH]) {
   }
 }
 
+static inline u16 rgb15_to_rgb565(u16 color) {
+  u16 r = (color & 0x1F);
+  u16 g = (color >> 5) & 0x1F;
+  u16 b = (color >> 10) & 0x1F;
+
+  g = (g << 1) | (g >> 4);
+
+  return (r << 11) | (g << 5) | b;
+}
+
+static inline u32 convert_color(PixelFormat format, u16 color) {
+  switch (format) {
+  case PIXEL_FORMAT_RGB565:
+    return rgb15_to_rgb565(color);
+  case PIXEL_FORMAT_BGR555:
+    return color & 0x7FFF;
+  default:
+    return rgb15_to_argb(color);
+  }
+}
+
+static void update_palette_cache(Gba *gba) {
+  u16 *palram = (u16 *)gba->ppu.palram;
+  for (int i = 0; i < 256; i++) {
+    u16 color = palram[i] == TRANSPARENT ? palram[0] : palram[i];
+    gba->palette_cache[i] = convert_color(gba->video_format, color);
+  }
+  gba->palette_dirty = false;
+}
+
+#ifdef __SSE2__
+static inline __m128i fill_transparent(__m128i px, __m128i fill) {
+  __m128i is_transparent =
+      _mm_cmpeq_epi16(px, _mm_set1_epi16((short)TRANSPARENT));
+  return _mm_or_si128(_mm_andnot_si128(is_transparent, px),
+                      _mm_and_si128(is_transparent, fill));
+}
+#endif
+
+static void write_row_argb(u32 *dest, const u16 *src, int count,
+                           u16 backdrop) {
+  int x = 0;
+#ifdef __SSE2__
+  const __m128i mask = _mm_set1_epi16(0x1F);
+  const __m128i alpha = _mm_set1_epi16((short)0xFF00);
+  const __m128i fill = _mm_set1_epi16(backdrop);
+  for (; x + 8 <= count; x += 8) {
+    __m128i px = _mm_loadu_si128((const __m128i *)(src + x));
+    px = fill_transparent(px, fill);
+
+    __m128i r = _mm_and_si128(px, mask);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(px, 5), mask);
+    __m128i b = _mm_and_si128(_mm_srli_epi16(px, 10), mask);
+    r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+    b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+    __m128i lo = _mm_or_si128(_mm_slli_epi16(g, 8), b);
+    __m128i hi = _mm_or_si128(r, alpha);
+    _mm_storeu_si128((__m128i *)(dest + x), _mm_unpacklo_epi16(lo, hi));
+    _mm_storeu_si128((__m128i *)(dest + x + 4), _mm_unpackhi_epi16(lo, hi));
+  }
+#endif
+  for (; x < count; x++) {
+    u16 color = src[x] == TRANSPARENT ? backdrop : src[x];
+    dest[x] = rgb15_to_argb(color);
+  }
+}
+
+static void write_row_rgb565(u16 *dest, const u16 *src, int count,
+                             u16 backdrop) {
+  int x = 0;
+#ifdef __SSE2__
+  const __m128i mask = _mm_set1_epi16(0x1F);
+  const __m128i fill = _mm_set1_epi16(backdrop);
+  for (; x + 8 <= count; x += 8) {
+    __m128i px = _mm_loadu_si128((const __m128i *)(src + x));
+    px = fill_transparent(px, fill);
+
+    __m128i r = _mm_and_si128(px, mask);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(px, 5), mask);
+    __m128i b = _mm_and_si128(_mm_srli_epi16(px, 10), mask);
+    g = _mm_or_si128(_mm_slli_epi16(g, 1), _mm_srli_epi16(g, 4));
+
+    __m128i out = _mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5));
+    _mm_storeu_si128((__m128i *)(dest + x), _mm_or_si128(out, b));
+  }
+#endif
+  for (; x < count; x++) {
+    u16 color = src[x] == TRANSPARENT ? backdrop : src[x];
+    dest[x] = rgb15_to_rgb565(color);
+  }
+}
+
+static void write_row_bgr555(u16 *dest, const u16 *src, int count,
+                             u16 backdrop) {
+  for (int x = 0; x < count; x++) {
+    u16 color = src[x] == TRANSPARENT ? backdrop : src[x];
+    dest[x] = color & 0x7FFF;
+  }
+}
+
+// Writes `count` BGR555 pixels starting at `x` in the configured output
+// format, showing the backdrop where a pixel reads as TRANSPARENT like the
+// compositor would.
+static void write_row(PixelFormat format, u8 *out, int x, const u16 *src,
+                      int count, u16 backdrop) {
+  switch (format) {
+  case PIXEL_FORMAT_ARGB8888:
+    write_row_argb((u32 *)out + x, src, count, backdrop);
+    break;
+  case PIXEL_FORMAT_RGB565:
+    write_row_rgb565((u16 *)out + x, src, count, backdrop);
+    break;
+  case PIXEL_FORMAT_BGR555:
+    write_row_bgr555((u16 *)out + x, src, count, backdrop);
+    break;
+  }
+}
+
+static bool bitmap_line_is_plain(Ppu *ppu, ObjBufferEntry obj_buffer[]) {
+  if (!ppu->Lcd.dispcnt.enable[2]) {
+    return false;
+  }
+  if (ppu->Lcd.dispcnt.enable[5] || ppu->Lcd.dispcnt.enable[6] ||
+      ppu->Lcd.dispcnt.enable[7]) {
+    return false;
+  }
+  if (ppu->Lcd.blendcnt.effect != NONE &&
+      (ppu->Lcd.blendcnt.targets[0][2] ||
+       ppu->Lcd.blendcnt.targets[0][BACKDROP_IDX])) {
+    return false;
+  }
+  if (ppu->Lcd.dispcnt.enable[4]) {
+    for (int x = 0; x < PIXELS_WIDTH; x++) {
+      if (obj_buffer[x].color != TRANSPARENT) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Bitmap modes with only BG2 visible on the line skip the compositor and
+// write the converted row straight to the output.
+static bool render_bitmap_direct(Gba *gba, u8 *out,
+                                 ObjBufferEntry obj_buffer[]) {
+  Ppu *ppu = &gba->ppu;
+  PixelFormat format = gba->video_format;
+  if (!bitmap_line_is_plain(ppu, obj_buffer)) {
+    return false;
+  }
+
+  int y = ppu->Lcd.vcount;
+  u16 backdrop = ((u16 *)ppu->palram)[0] & 0x7FFF;
+
+  switch (ppu->Lcd.dispcnt.mode) {
+  case 3: {
+    u16 *vram_ptr = (u16 *)ppu->vram + (y * PIXELS_WIDTH);
+    write_row(format, out, 0, vram_ptr, PIXELS_WIDTH, backdrop);
+    break;
+  }
+  case 4: {
+    u8 *vram_ptr =
+        ppu->vram + (ppu->Lcd.dispcnt.page * 0xA000) + (y * PIXELS_WIDTH);
+    if (gba->palette_dirty) {
+      update_palette_cache(gba);
+    }
+    if (format == PIXEL_FORMAT_ARGB8888) {
+      u32 *dest = (u32 *)out;
+      for (int x = 0; x < PIXELS_WIDTH; x++) {
+        dest[x] = gba->palette_cache[vram_ptr[x]];
+      }
+    } else {
+      u16 *dest = (u16 *)out;
+      for (int x = 0; x < PIXELS_WIDTH; x++) {
+        dest[x] = gba->palette_cache[vram_ptr[x]];
+      }
+    }
+    break;
+  }
+  case 5: {
+    u16 outside[PIXELS_WIDTH];
+    for (int x = 0; x < PIXELS_WIDTH; x++) {
+      outside[x] = 0x7C1F;
+    }
+    int x = 0;
+    if (y < 128) {
+      u16 *vram_ptr = (u16 *)(ppu->vram + (ppu->Lcd.dispcnt.page * 0xA000)) +
+                      (y * PIXELS_HEIGHT);
+      write_row(format, out, 0, vram_ptr, PIXELS_HEIGHT, backdrop);
+      x = PIXELS_HEIGHT;
+    }
+    write_row(format, out, x, outside, PIXELS_WIDTH - x, backdrop);
+    break;
+  }
+  }
+  return true;
+}
+
 void ppu_init(Ppu *ppu) { memset(ppu, 0, sizeof(Ppu)); }
 
+int ppu_bytes_per_pixel(PixelFormat format) {
+  return format == PIXEL_FORMAT_ARGB8888 ? 4 : 2;
+}
+
+// The output buffer and its format are host-side and kept outside the Ppu
+// state; NULL selects the internal framebuffer, pitched for the format.
+void ppu_set_output(Gba *gba, void *buffer, int pitch) {
+  gba->video_output = buffer;
+  gba->video_pitch = pitch;
+}
+
+void ppu_set_skip_video(Gba *gba, bool skip) { gba->skip_video = skip; }
+
+void ppu_set_format(Gba *gba, PixelFormat format) {
+  gba->video_format = format;
+  gba->palette_dirty = true;
+}
+
 static u16 blend(u16 color_a, u16 color_b, int weight_a, int weight_b) {
   int r_a = (color_a & 0x1F);
   int g_a = (color_a >> 5) & 0x1F;
@@ -572,32 +838,43 @@ static bool in_win(int v, int left, int right) {
   }
 }
 
-static void render_scanline(Ppu *ppu) {
+// Renders the current scanline into `out`, one row of the output buffer.
+static void render_scanline(Gba *gba, u8 *out) {
+  Ppu *ppu = &gba->ppu;
+  PixelFormat format = gba->video_format;
   int y = ppu->Lcd.vcount;
   if (ppu->Lcd.dispcnt.forced_blank) {
-    u32 *dest = ppu->framebuffer + (y * PIXELS_WIDTH);
+    u16 line[PIXELS_WIDTH];
     for (int i = 0; i < PIXELS_WIDTH; i++)
-      dest[i] = 0xFFFFFFFF;
+      line[i] = WHITE;
+    write_row(format, out, 0, line, PIXELS_WIDTH, WHITE);
     return;
   }
 
   ObjBufferEntry obj_buffer[PIXELS_WIDTH];
   memset(obj_buffer, 0, sizeof(obj_buffer));
 
-  u16 bg_buffers[4][PIXELS_WIDTH];
-
   for (int i = 0; i < PIXELS_WIDTH; i++) {
     obj_buffer[i].color = TRANSPARENT;
     obj_buffer[i].prio = 4;
+  }
+
+  render_objs(ppu, obj_buffer);
 
+  int mode = ppu->Lcd.dispcnt.mode;
+  if (mode >= 3 && mode <= 5 && render_bitmap_direct(gba, out, obj_buffer)) {
+    return;
+  }
+
+  u16 bg_buffers[4][PIXELS_WIDTH];
+
+  for (int i = 0; i < PIXELS_WIDTH; i++) {
     bg_buffers[0][i] = TRANSPARENT;
     bg_buffers[1][i] = TRANSPARENT;
     bg_buffers[2][i] = TRANSPARENT;
     bg_buffers[3][i] = TRANSPARENT;
   }
 
-  render_objs(ppu, obj_buffer);
-
   switch (ppu->Lcd.dispcnt.mode) {
   case 0:
     render_mode0(ppu, bg_buffers);
@@ -622,7 +899,7 @@ static void render_scanline(Ppu *ppu) {
     break;
   }
 
-  u32 *dest = ppu->framebuffer + (y * PIXELS_WIDTH);
+  u16 line[PIXELS_WIDTH];
 
   u16 backdrop_color = ((u16 *)ppu->palram)[0] & 0x7FFF;
   Layer backdrop = (Layer){backdrop_color, BACKDROP_IDX, 4};
@@ -703,7 +980,7 @@ static void render_scanline(Ppu *ppu) {
     bool blend_obj = (top.idx == OBJ_IDX) && entry.blend;
 
     if (!(blend_obj || window[WIN_BLD_IDX])) {
-      dest[x] = rgb15_to_argb(top.color);
+      line[x] = top.color;
       continue;
     }
 
@@ -740,8 +1017,10 @@ static void render_scanline(Ppu *ppu) {
       }
     }
 
-    dest[x] = rgb15_to_argb(color);
+    line[x] = color;
   }
+
+  write_row(format, out, 0, line, PIXELS_WIDTH, backdrop_color);
 }
 
 void update_vcounter(Gba *gba) {
@@ -763,7 +1042,9 @@ void update_vcounter(Gba *gba) {
 void ppu_hblank_start(Gba *gba, uint lateness) {
   Ppu *ppu = &gba->ppu;
 
-  render_scanline(ppu);
+  if (!gba->skip_video) {
+    render_scanline(gba, output_line(gba, ppu->Lcd.vcount));
+  }
 
   ppu->Lcd.dispstat.hblank = 1;
   ppu->Lcd.dispstat.val |= 2;
@@ -0,0 +1,449 @@
+#include "psg.h"
+#include "apu.h"
+#include "gba.h"
+#include "io.h"
+#include "scheduler.h"
+#include <string.h>
+
+static const u8 duty_table[4][8] = {{0, 0, 0, 0, 0, 0, 0, 1},
+                                    {1, 0, 0, 0, 0, 0, 0, 1},
+                                    {1, 0, 0, 0, 0, 1, 1, 1},
+                                    {0, 1, 1, 1, 1, 1, 1, 0}};
+
+// Readable bits of each 16-bit register from SOUND1CNT_L to SOUNDCNT_L.
+static const u16 read_mask[17] = {0x007F, 0xFFC0, 0x4000, 0x0000, 0xFFC0,
+                                  0x0000, 0x4000, 0x0000, 0x00E0, 0xE000,
+                                  0x4000, 0x0000, 0xFF00, 0x0000, 0x40FF,
+                                  0x0000, 0xFF77};
+
+void psg_init(Psg *psg) {
+  memset(psg, 0, sizeof(Psg));
+  psg->noise.lfsr = 0x4000;
+}
+
+static inline uint square_period(SquareChannel *ch) {
+  return 16 * (2048 - ch->freq);
+}
+
+static inline uint wave_period(WaveChannel *ch) {
+  return 8 * (2048 - ch->freq);
+}
+
+static inline uint noise_period(NoiseChannel *ch) {
+  return (ch->divider ? ch->divider * 64 : 32) << ch->shift;
+}
+
+// Folds elapsed whole steps into phase_base so start_time stays recent.
+static void square_rebase(SquareChannel *ch, uint now) {
+  uint period = square_period(ch);
+  uint steps = (now - ch->start_time) / period;
+  ch->phase_base += steps;
+  ch->start_time += steps * period;
+}
+
+static void wave_rebase(WaveChannel *ch, uint now) {
+  uint period = wave_period(ch);
+  uint steps = (now - ch->start_time) / period;
+  ch->phase_base += steps;
+  ch->start_time += steps * period;
+}
+
+static void noise_advance(NoiseChannel *ch, uint time) {
+  u32 due = (time - ch->start_time) / noise_period(ch);
+  u32 steps = due - ch->steps;
+  u32 lfsr_period = ch->width_7 ? 127 : 32767;
+  if (steps > lfsr_period) {
+    steps = lfsr_period + steps % lfsr_period;
+  }
+
+  u16 tap = ch->width_7 ? 0x60 : 0x6000;
+  for (u32 i = 0; i < steps; i++) {
+    bool carry = ch->lfsr & 1;
+    ch->lfsr >>= 1;
+    if (carry) {
+      ch->lfsr ^= tap;
+    }
+    ch->output = carry;
+  }
+  ch->steps = due;
+}
+
+static void noise_rebase(NoiseChannel *ch, uint now) {
+  noise_advance(ch, now);
+  ch->start_time += ch->steps * noise_period(ch);
+  ch->steps = 0;
+}
+
+static void start_sequencer(Gba *gba) {
+  Psg *psg = &gba->apu.psg;
+  if (psg->sequencer_running) {
+    return;
+  }
+  psg->sequencer_running = true;
+  scheduler_push_event(&gba->scheduler, EVENT_TYPE_APU_SEQUENCER,
+                       PSG_SEQUENCER_CYCLES);
+}
+
+static int sweep_calc(SquareChannel *ch) {
+  int delta = ch->shadow_freq >> ch->sweep_shift;
+  int freq = ch->sweep_decrease ? ch->shadow_freq - delta
+                                : ch->shadow_freq + delta;
+  if (freq > 2047) {
+    ch->enable = false;
+  }
+  return freq;
+}
+
+static void square_trigger(Gba *gba, SquareChannel *ch) {
+  uint now = gba->scheduler.current_time;
+
+  ch->enable = ch->dac_enable;
+  if (ch->length == 0) {
+    ch->length = 64;
+  }
+  ch->volume = ch->initial_volume;
+  ch->env_timer = ch->env_period;
+  ch->start_time = now;
+  ch->phase_base = 0;
+
+  ch->shadow_freq = ch->freq;
+  ch->sweep_timer = ch->sweep_period ? ch->sweep_period : 8;
+  ch->sweep_enable = ch->sweep_period || ch->sweep_shift;
+  if (ch->sweep_shift) {
+    sweep_calc(ch);
+  }
+
+  start_sequencer(gba);
+}
+
+static void square_envelope_write(SquareChannel *ch, u16 val, bool low) {
+  if (low) {
+    ch->length = 64 - GET_BITS(val, 0, 6);
+  }
+  ch->duty = GET_BITS(val, 6, 2);
+  ch->env_period = GET_BITS(val, 8, 3);
+  ch->env_increase = TEST_BIT(val, 11);
+  ch->initial_volume = GET_BITS(val, 12, 4);
+  ch->dac_enable = (val & 0xF800) != 0;
+  if (!ch->dac_enable) {
+    ch->enable = false;
+  }
+}
+
+static void square_freq_write(Gba *gba, SquareChannel *ch, u16 val,
+                              bool high) {
+  square_rebase(ch, gba->scheduler.current_time);
+  ch->freq = GET_BITS(val, 0, 11);
+  ch->length_enable = TEST_BIT(val, 14);
+  if (high && TEST_BIT(val, 15)) {
+    square_trigger(gba, ch);
+  }
+}
+
+static void wave_trigger(Gba *gba, WaveChannel *ch) {
+  ch->enable = ch->dac_enable;
+  if (ch->length == 0) {
+    ch->length = 256;
+  }
+  ch->start_time = gba->scheduler.current_time;
+  ch->phase_base = 0;
+
+  start_sequencer(gba);
+}
+
+static void noise_trigger(Gba *gba, NoiseChannel *ch) {
+  ch->enable = ch->dac_enable;
+  if (ch->length == 0) {
+    ch->length = 64;
+  }
+  ch->volume = ch->initial_volume;
+  ch->env_timer = ch->env_period;
+  ch->lfsr = ch->width_7 ? 0x40 : 0x4000;
+  ch->output = false;
+  ch->start_time = gba->scheduler.current_time;
+  ch->steps = 0;
+
+  start_sequencer(gba);
+}
+
+u8 psg_read8(Gba *gba, u32 addr) {
+  Psg *psg = &gba->apu.psg;
+  int offset = addr - SOUND1CNT_L;
+  u16 mask = read_mask[offset >> 1];
+  return psg->regs[offset] & (mask >> ((offset & 1) * 8));
+}
+
+void psg_write8(Gba *gba, u32 addr, u8 val) {
+  Psg *psg = &gba->apu.psg;
+  uint now = gba->scheduler.current_time;
+
+  // The PSG registers are read-only while the sound circuit is off.
+  if (!gba->apu.master_enable) {
+    return;
+  }
+
+  apu_sync(gba);
+
+  int offset = addr - SOUND1CNT_L;
+  psg->regs[offset] = val;
+
+  int reg_offset = offset & ~1;
+  u16 reg = psg->regs[reg_offset] | (psg->regs[reg_offset + 1] << 8);
+  bool high = offset & 1;
+
+  switch (addr & ~1) {
+  case SOUND1CNT_L: {
+    SquareChannel *ch = &psg->square[0];
+    ch->sweep_shift = GET_BITS(reg, 0, 3);
+    ch->sweep_decrease = TEST_BIT(reg, 3);
+    ch->sweep_period = GET_BITS(reg, 4, 3);
+    break;
+  }
+  case SOUND1CNT_H:
+    square_envelope_write(&psg->square[0], reg, !high);
+    break;
+  case SOUND1CNT_X:
+    square_freq_write(gba, &psg->square[0], reg, high);
+    break;
+  case SOUND2CNT_L:
+    square_envelope_write(&psg->square[1], reg, !high);
+    break;
+  case SOUND2CNT_H:
+    square_freq_write(gba, &psg->square[1], reg, high);
+    break;
+  case SOUND3CNT_L: {
+    WaveChannel *ch = &psg->wave;
+    ch->dimension = TEST_BIT(reg, 5);
+    ch->bank = TEST_BIT(reg, 6);
+    ch->dac_enable = TEST_BIT(reg, 7);
+    if (!ch->dac_enable) {
+      ch->enable = false;
+    }
+    break;
+  }
+  case SOUND3CNT_H: {
+    WaveChannel *ch = &psg->wave;
+    if (!high) {
+      ch->length = 256 - GET_BITS(reg, 0, 8);
+    }
+    ch->volume = GET_BITS(reg, 13, 2);
+    ch->force_volume = TEST_BIT(reg, 15);
+    break;
+  }
+  case SOUND3CNT_X: {
+    WaveChannel *ch = &psg->wave;
+    wave_rebase(ch, now);
+    ch->freq = GET_BITS(reg, 0, 11);
+    ch->length_enable = TEST_BIT(reg, 14);
+    if (high && TEST_BIT(reg, 15)) {
+      wave_trigger(gba, ch);
+    }
+    break;
+  }
+  case SOUND4CNT_L: {
+    NoiseChannel *ch = &psg->noise;
+    if (!high) {
+      ch->length = 64 - GET_BITS(reg, 0, 6);
+    }
+    ch->env_period = GET_BITS(reg, 8, 3);
+    ch->env_increase = TEST_BIT(reg, 11);
+    ch->initial_volume = GET_BITS(reg, 12, 4);
+    ch->dac_enable = (reg & 0xF800) != 0;
+    if (!ch->dac_enable) {
+      ch->enable = false;
+    }
+    break;
+  }
+  case SOUND4CNT_H: {
+    NoiseChannel *ch = &psg->noise;
+    noise_rebase(ch, now);
+    ch->divider = GET_BITS(reg, 0, 3);
+    ch->width_7 = TEST_BIT(reg, 3);
+    ch->shift = GET_BITS(reg, 4, 4);
+    ch->length_enable = TEST_BIT(reg, 14);
+    if (high && TEST_BIT(reg, 15)) {
+      noise_trigger(gba, ch);
+    }
+    break;
+  }
+  case SOUNDCNT_L:
+    psg->volume_right = GET_BITS(reg, 0, 3);
+    psg->volume_left = GET_BITS(reg, 4, 3);
+    for (int i = 0; i < 4; i++) {
+      psg->enable_right[i] = TEST_BIT(reg, 8 + i);
+      psg->enable_left[i] = TEST_BIT(reg, 12 + i);
+    }
+    break;
+  }
+}
+
+// The CPU sees the wave RAM bank that is not selected for playback.
+u8 psg_wave_read8(Gba *gba, u32 addr) {
+  WaveChannel *ch = &gba->apu.psg.wave;
+  return ch->ram[!ch->bank][addr - WAVE_RAM0_L];
+}
+
+void psg_wave_write8(Gba *gba, u32 addr, u8 val) {
+  WaveChannel *ch = &gba->apu.psg.wave;
+  apu_sync(gba);
+  ch->ram[!ch->bank][addr - WAVE_RAM0_L] = val;
+}
+
+u8 psg_status(Psg *psg) {
+  return psg->square[0].enable | psg->square[1].enable << 1 |
+         psg->wave.enable << 2 | psg->noise.enable << 3;
+}
+
+void psg_disable(Gba *gba) {
+  Psg *psg = &gba->apu.psg;
+  apu_sync(gba);
+  u8 wave_ram[2][16];
+  memcpy(wave_ram, psg->wave.ram, sizeof(wave_ram));
+  bool sequencer_running = psg->sequencer_running;
+  psg_init(psg);
+  memcpy(psg->wave.ram, wave_ram, sizeof(wave_ram));
+  psg->sequencer_running = sequencer_running;
+}
+
+static int square_output(SquareChannel *ch, uint time) {
+  if (!ch->enable) {
+    return 0;
+  }
+  u32 step = ch->phase_base + (time - ch->start_time) / square_period(ch);
+  return duty_table[ch->duty][step & 7] ? ch->volume : -ch->volume;
+}
+
+static int wave_output(WaveChannel *ch, uint time) {
+  static const int volume_mult[4] = {0, 4, 2, 1};
+
+  if (!ch->enable) {
+    return 0;
+  }
+  u32 step = ch->phase_base + (time - ch->start_time) / wave_period(ch);
+  int pos = step % (ch->dimension ? 64 : 32);
+  int bank = ch->dimension ? ch->bank ^ (pos >> 5) : ch->bank;
+  u8 byte = ch->ram[bank][(pos & 31) >> 1];
+  int sample = (pos & 1) ? byte & 0xF : byte >> 4;
+
+  int mult = ch->force_volume ? 3 : volume_mult[ch->volume];
+  return ((sample * 2 - 15) * mult) >> 2;
+}
+
+static int noise_output(NoiseChannel *ch, uint time) {
+  if (!ch->enable) {
+    return 0;
+  }
+  noise_advance(ch, time);
+  return ch->output ? ch->volume : -ch->volume;
+}
+
+void psg_sample(Psg *psg, uint time, int *left, int *right) {
+  int out[4] = {square_output(&psg->square[0], time),
+                square_output(&psg->square[1], time),
+                wave_output(&psg->wave, time),
+                noise_output(&psg->noise, time)};
+
+  int l = 0;
+  int r = 0;
+  for (int i = 0; i < 4; i++) {
+    if (psg->enable_left[i]) {
+      l += out[i];
+    }
+    if (psg->enable_right[i]) {
+      r += out[i];
+    }
+  }
+  *left = l * (psg->volume_left + 1);
+  *right = r * (psg->volume_right + 1);
+}
+
+static void clock_length(bool *enable, int *length, bool length_enable) {
+  if (length_enable && *length > 0) {
+    (*length)--;
+    if (*length == 0) {
+      *enable = false;
+    }
+  }
+}
+
+static void clock_envelope(int *volume, int period, bool increase,
+                           int *timer) {
+  if (period == 0) {
+    return;
+  }
+  if (--(*timer) > 0) {
+    return;
+  }
+  *timer = period;
+  if (increase && *volume < 15) {
+    (*volume)++;
+  } else if (!increase && *volume > 0) {
+    (*volume)--;
+  }
+}
+
+static void clock_sweep(Gba *gba, SquareChannel *ch) {
+  if (--ch->sweep_timer > 0) {
+    return;
+  }
+  ch->sweep_timer = ch->sweep_period ? ch->sweep_period : 8;
+  if (!ch->sweep_enable || ch->sweep_period == 0) {
+    return;
+  }
+
+  int freq = sweep_calc(ch);
+  if (freq <= 2047 && ch->sweep_shift) {
+    square_rebase(ch, gba->scheduler.current_time);
+    ch->shadow_freq = freq;
+    ch->freq = freq;
+    sweep_calc(ch);
+  }
+}
+
+void psg_sequencer_step(Gba *gba, uint lateness) {
+  Psg *psg = &gba->apu.psg;
+  uint now = gba->scheduler.current_time;
+
+  apu_sync(gba);
+
+  int step = psg->sequencer_step;
+  if (step % 2 == 0) {
+    for (int i = 0; i < 2; i++) {
+      SquareChannel *ch = &psg->square[i];
+      clock_length(&ch->enable, &ch->length, ch->length_enable);
+    }
+    clock_length(&psg->wave.enable, &psg->wave.length,
+                 psg->wave.length_enable);
+    clock_length(&psg->noise.enable, &psg->noise.length,
+                 psg->noise.length_enable);
+  }
+  if (step == 2 || step == 6) {
+    clock_sweep(gba, &psg->square[0]);
+  }
+  if (step == 7) {
+    for (int i = 0; i < 2; i++) {
+      SquareChannel *ch = &psg->square[i];
+      clock_envelope(&ch->volume, ch->env_period, ch->env_increase,
+                     &ch->env_timer);
+    }
+    clock_envelope(&psg->noise.volume, psg->noise.env_period,
+                   psg->noise.env_increase, &psg->noise.env_timer);
+  }
+  psg->sequencer_step = (step + 1) % 8;
+
+  // Channel phases only matter to synthesis; skip the LFSR stepping too.
+  if (gba->synthesize) {
+    square_rebase(&psg->square[0], now);
+    square_rebase(&psg->square[1], now);
+    wave_rebase(&psg->wave, now);
+    noise_rebase(&psg->noise, now);
+  }
+
+  // Idle channels cost nothing: the sequencer stops with the last one.
+  if (psg_status(psg)) {
+    scheduler_push_event(&gba->scheduler, EVENT_TYPE_APU_SEQUENCER,
+                         PSG_SEQUENCER_CYCLES - lateness);
+  } else {
+    psg->sequencer_running = false;
+  }
+}
@@ -0,0 +1,173 @@
+#include "resampler.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static double blackman(double x, double half_width) {
+  double t = M_PI * x / half_width;
+  return 0.42 + 0.5 * cos(t) + 0.08 * cos(2 * t);
+}
+
+static void build_kernel(Resampler *rs, double cutoff) {
+  const double half = RESAMPLER_TAPS / 2;
+
+  for (int p = 0; p <= RESAMPLER_PHASES; p++) {
+    double frac = (double)p / RESAMPLER_PHASES;
+    double sum = 0;
+    double taps[RESAMPLER_TAPS];
+
+    for (int k = 0; k < RESAMPLER_TAPS; k++) {
+      double x = half - 1 + frac - k;
+      double sinc = x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+      double w = fabs(x) < half ? blackman(x, half) : 0;
+      taps[k] = cutoff * sinc * w;
+      sum += taps[k];
+    }
+    // Normalise each phase to unity DC gain so the output has no ripple.
+    for (int k = 0; k < RESAMPLER_TAPS; k++) {
+      rs->kernel[p][k] = taps[k] / sum;
+    }
+  }
+}
+
+void resampler_init(Resampler *rs, int in_rate, int out_rate) {
+  memset(rs, 0, sizeof(Resampler));
+
+  rs->base_ratio = (double)in_rate / out_rate;
+  rs->step = (u64)(rs->base_ratio * 4294967296.0);
+
+  // Pass band ends slightly below the lower of the two Nyquist rates.
+  build_kernel(rs, 0.9 * MIN(1.0, 1.0 / rs->base_ratio));
+
+  // Start with a window of silence so the first input frame is centred.
+  rs->history_len = RESAMPLER_TAPS - 1;
+}
+
+void resampler_set_adjust(Resampler *rs, double adjust) {
+  rs->step = (u64)(rs->base_ratio * adjust * 4294967296.0);
+}
+
+int resampler_max_output(Resampler *rs, int in_frames) {
+  return (int)(((u64)(in_frames + RESAMPLER_TAPS) << 32) / rs->step) + 1;
+}
+
+static inline s16 to_s16(float v) {
+  if (v >= 32767.0f) {
+    return 32767;
+  }
+  if (v <= -32768.0f) {
+    return -32768;
+  }
+  return (s16)(v < 0 ? v - 0.5f : v + 0.5f);
+}
+
+// Convolves both channels at history index `i` with the kernel interpolated
+// between phases `phase` and `phase + 1` by `t`.
+static inline void convolve(Resampler *rs, int i, int phase, float t,
+                            float *left, float *right) {
+  const float *k0 = rs->kernel[phase];
+  const float *k1 = rs->kernel[phase + 1];
+  const float *l = &rs->history[0][i];
+  const float *r = &rs->history[1][i];
+
+#if defined(__AVX__)
+  __m256 tv = _mm256_set1_ps(t);
+  __m256 acc_l = _mm256_setzero_ps();
+  __m256 acc_r = _mm256_setzero_ps();
+  for (int k = 0; k < RESAMPLER_TAPS; k += 8) {
+    __m256 a = _mm256_load_ps(k0 + k);
+    __m256 b = _mm256_load_ps(k1 + k);
+    __m256 coef = _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), tv));
+    acc_l = _mm256_add_ps(acc_l, _mm256_mul_ps(coef, _mm256_loadu_ps(l + k)));
+    acc_r = _mm256_add_ps(acc_r, _mm256_mul_ps(coef, _mm256_loadu_ps(r + k)));
+  }
+  // Horizontal sums of both accumulators at once.
+  __m256 sum = _mm256_hadd_ps(acc_l, acc_r);
+  sum = _mm256_hadd_ps(sum, sum);
+  __m128 lanes = _mm_add_ps(_mm256_castps256_ps128(sum),
+                            _mm256_extractf128_ps(sum, 1));
+  *left = _mm_cvtss_f32(lanes);
+  *right = _mm_cvtss_f32(_mm_shuffle_ps(lanes, lanes, 1));
+#elif defined(__SSE2__)
+  __m128 tv = _mm_set1_ps(t);
+  __m128 acc_l = _mm_setzero_ps();
+  __m128 acc_r = _mm_setzero_ps();
+  for (int k = 0; k < RESAMPLER_TAPS; k += 4) {
+    __m128 a = _mm_load_ps(k0 + k);
+    __m128 b = _mm_load_ps(k1 + k);
+    __m128 coef = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), tv));
+    acc_l = _mm_add_ps(acc_l, _mm_mul_ps(coef, _mm_loadu_ps(l + k)));
+    acc_r = _mm_add_ps(acc_r, _mm_mul_ps(coef, _mm_loadu_ps(r + k)));
+  }
+  // Transpose-free reduction: interleave the halves of both accumulators.
+  __m128 lo = _mm_unpacklo_ps(acc_l, acc_r);
+  __m128 hi = _mm_unpackhi_ps(acc_l, acc_r);
+  __m128 sum = _mm_add_ps(lo, hi);
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  *left = _mm_cvtss_f32(sum);
+  *right = _mm_cvtss_f32(_mm_shuffle_ps(sum, sum, 1));
+#else
+  float acc_l = 0;
+  float acc_r = 0;
+  for (int k = 0; k < RESAMPLER_TAPS; k++) {
+    float coef = k0[k] + (k1[k] - k0[k]) * t;
+    acc_l += coef * l[k];
+    acc_r += coef * r[k];
+  }
+  *left = acc_l;
+  *right = acc_r;
+#endif
+}
+
+static int process_chunk(Resampler *rs, const s16 *in, int in_frames,
+                         s16 *out) {
+  for (int i = 0; i < in_frames; i++) {
+    rs->history[0][rs->history_len + i] = in[i * 2];
+    rs->history[1][rs->history_len + i] = in[i * 2 + 1];
+  }
+  rs->history_len += in_frames;
+
+  int produced = 0;
+  while ((int)(rs->pos >> 32) + RESAMPLER_TAPS <= rs->history_len) {
+    int i = rs->pos >> 32;
+    u32 frac = (u32)rs->pos;
+    int phase = frac >> 24; // top 8 bits select one of 256 phases
+    float t = (frac & 0xFFFFFF) * (1.0f / 16777216.0f);
+
+    float left, right;
+    convolve(rs, i, phase, t, &left, &right);
+    out[produced * 2] = to_s16(left);
+    out[produced * 2 + 1] = to_s16(right);
+    produced++;
+
+    rs->pos += rs->step;
+  }
+
+  // Keep the frames the next output still needs.
+  int consumed = MIN((int)(rs->pos >> 32), rs->history_len);
+  int remaining = rs->history_len - consumed;
+  for (int c = 0; c < 2; c++) {
+    memmove(rs->history[c], &rs->history[c][consumed],
+            remaining * sizeof(float));
+  }
+  rs->history_len = remaining;
+  rs->pos -= (u64)consumed << 32;
+
+  return produced;
+}
+
+int resampler_process(Resampler *rs, const s16 *in, int in_frames, s16 *out) {
+  int produced = 0;
+  while (in_frames > 0) {
+    int n = MIN(in_frames, RESAMPLER_CHUNK);
+    produced += process_chunk(rs, in, n, out + produced * 2);
+    in += n * 2;
+    in_frames -= n;
+  }
+  return produced;
+}
@@ -0,0 +1,290 @@
+#include "rewind.h"
+#include "gba.h"
+#include <string.h>
+
+// Deltas work on 64-bit words; the snapshot buffers are padded to a whole
+// number of them with zeros.
+#define STATE_WORDS ((GBA_STATE_SIZE + 7) / 8)
+
+// Each run is at most two varints of header per literal run, so this bounds
+// the encoding of a delta that differs everywhere.
+#define DELTA_BOUND (STATE_WORDS * 8 + STATE_WORDS / 2 * 10 + 20)
+
+#define MAX_DELTAS 0x10000
+
+static inline u64 read64(const u8 *p) {
+  u64 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void write64(u8 *p, u64 v) { memcpy(p, &v, sizeof(v)); }
+
+static u8 *write_varint(u8 *out, size_t v) {
+  while (v >= 0x80) {
+    *out++ = v | 0x80;
+    v >>= 7;
+  }
+  *out++ = v;
+  return out;
+}
+
+static bool read_varint(const u8 **in, const u8 *end, size_t *v) {
+  *v = 0;
+  for (int shift = 0; *in < end && shift < 64; shift += 7) {
+    u8 b = *(*in)++;
+    *v |= (size_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Encodes `a ^ b` as alternating runs: a count of zero words, then a count
+// of literal words followed by their XORed values.
+static u32 encode_delta(const u8 *a, const u8 *b, u8 *out) {
+  u8 *start = out;
+  size_t i = 0;
+  while (i < STATE_WORDS) {
+    size_t zeros = i;
+    while (i < STATE_WORDS && read64(a + i * 8) == read64(b + i * 8)) {
+      i++;
+    }
+    zeros = i - zeros;
+
+    size_t literal = i;
+    while (i < STATE_WORDS && read64(a + i * 8) != read64(b + i * 8)) {
+      i++;
+    }
+
+    out = write_varint(out, zeros);
+    out = write_varint(out, i - literal);
+    for (size_t j = literal; j < i; j++) {
+      write64(out, read64(a + j * 8) ^ read64(b + j * 8));
+      out += 8;
+    }
+  }
+  return out - start;
+}
+
+static bool apply_delta(u8 *state, const u8 *delta, u32 size) {
+  const u8 *in = delta;
+  const u8 *end = delta + size;
+  size_t i = 0;
+  while (in < end) {
+    size_t zeros, literal;
+    if (!read_varint(&in, end, &zeros) || !read_varint(&in, end, &literal)) {
+      return false;
+    }
+    if (zeros > STATE_WORDS - i || literal > STATE_WORDS - i - zeros ||
+        literal > (size_t)(end - in) / 8) {
+      return false;
+    }
+    i += zeros;
+    for (size_t j = 0; j < literal; j++, i++) {
+      write64(state + i * 8, read64(state + i * 8) ^ read64(in));
+      in += 8;
+    }
+  }
+  return i == STATE_WORDS;
+}
+
+static void drop_oldest(Rewind *rw) {
+  RewindDelta *delta = &rw->deltas[rw->head];
+  rw->used -= delta->size;
+  free(delta->data);
+  delta->data = NULL;
+  rw->head = (rw->head + 1) % rw->capacity;
+  rw->count--;
+}
+
+static void push_delta(Rewind *rw, const u8 *data, u32 size) {
+  while (rw->count > 0 &&
+         (rw->count == rw->capacity || rw->used + size > rw->budget)) {
+    drop_oldest(rw);
+  }
+  if (size > rw->budget) {
+    return;
+  }
+  u8 *copy = malloc(size);
+  if (!copy) {
+    return;
+  }
+  memcpy(copy, data, size);
+
+  RewindDelta *delta = &rw->deltas[(rw->head + rw->count) % rw->capacity];
+  delta->data = copy;
+  delta->size = size;
+  rw->used += size;
+  rw->count++;
+}
+
+static void *worker(void *arg) {
+  Rewind *rw = arg;
+  pthread_mutex_lock(&rw->lock);
+  while (true) {
+    while (!rw->pending && !rw->quit) {
+      pthread_cond_wait(&rw->cond, &rw->lock);
+    }
+    if (rw->quit) {
+      break;
+    }
+    bool has_base = rw->has_current;
+    pthread_mutex_unlock(&rw->lock);
+
+    // The delta turns the new snapshot back into the previous one.
+    u32 size = 0;
+    if (has_base) {
+      size = encode_delta(rw->staging, rw->current, rw->scratch);
+    }
+
+    pthread_mutex_lock(&rw->lock);
+    if (has_base) {
+      push_delta(rw, rw->scratch, size);
+    }
+    u8 *tmp = rw->current;
+    rw->current = rw->staging;
+    rw->staging = tmp;
+    rw->has_current = true;
+    rw->pending = false;
+    pthread_cond_broadcast(&rw->cond);
+  }
+  pthread_mutex_unlock(&rw->lock);
+  return NULL;
+}
+
+bool rewind_init(Rewind *rw, int interval, size_t budget) {
+  memset(rw, 0, sizeof(Rewind));
+  rw->interval = MAX(interval, 1);
+  rw->budget = budget;
+  rw->capacity = MAX_DELTAS;
+
+  rw->deltas = calloc(rw->capacity, sizeof(RewindDelta));
+  rw->staging = calloc(STATE_WORDS, 8);
+  rw->current = calloc(STATE_WORDS, 8);
+  rw->scratch = malloc(DELTA_BOUND);
+  if (!rw->deltas || !rw->staging || !rw->current || !rw->scratch) {
+    printf("Failed to allocate rewind buffers\n");
+    goto fail;
+  }
+
+  pthread_mutex_init(&rw->lock, NULL);
+  pthread_cond_init(&rw->cond, NULL);
+  if (pthread_create(&rw->thread, NULL, worker, rw) != 0) {
+    printf("Failed to start rewind thread\n");
+    pthread_cond_destroy(&rw->cond);
+    pthread_mutex_destroy(&rw->lock);
+    goto fail;
+  }
+  return true;
+
+fail:
+  free(rw->deltas);
+  free(rw->staging);
+  free(rw->current);
+  free(rw->scratch);
+  memset(rw, 0, sizeof(Rewind));
+  return false;
+}
+
+void rewind_free(Rewind *rw) {
+  if (!rw->deltas) {
+    return;
+  }
+  pthread_mutex_lock(&rw->lock);
+  rw->quit = true;
+  pthread_cond_broadcast(&rw->cond);
+  pthread_mutex_unlock(&rw->lock);
+  pthread_join(rw->thread, NULL);
+  pthread_cond_destroy(&rw->cond);
+  pthread_mutex_destroy(&rw->lock);
+
+  while (rw->count > 0) {
+    drop_oldest(rw);
+  }
+  free(rw->deltas);
+  free(rw->staging);
+  free(rw->current);
+  free(rw->scratch);
+  memset(rw, 0, sizeof(Rewind));
+}
+
+void rewind_capture(Rewind *rw, Gba *gba) {
+  if (++rw->counter < rw->interval) {
+    return;
+  }
+
+  pthread_mutex_lock(&rw->lock);
+  bool busy = rw->pending;
+  pthread_mutex_unlock(&rw->lock);
+  if (busy) {
+    return;
+  }
+  rw->counter = 0;
+
+  // The worker only touches `staging` while `pending` is set.
+  gba_snapshot(gba, rw->staging);
+
+  pthread_mutex_lock(&rw->lock);
+  rw->pending = true;
+  pthread_cond_signal(&rw->cond);
+  pthread_mutex_unlock(&rw->lock);
+}
+
+bool rewind_step(Rewind *rw, Gba *gba) {
+  pthread_mutex_lock(&rw->lock);
+  while (rw->pending) {
+    pthread_cond_wait(&rw->cond, &rw->lock);
+  }
+  if (rw->count == 0) {
+    pthread_mutex_unlock(&rw->lock);
+    return false;
+  }
+
+  u32 newest = (rw->head + rw->count - 1) % rw->capacity;
+  RewindDelta *delta = &rw->deltas[newest];
+  bool ok = apply_delta(rw->current, delta->data, delta->size);
+  rw->used -= delta->size;
+  free(delta->data);
+  delta->data = NULL;
+  rw->count--;
+  if (!ok) {
+    // Can't happen short of memory corruption, but don't restore garbage.
+    while (rw->count > 0) {
+      drop_oldest(rw);
+    }
+    rw->has_current = false;
+  }
+  pthread_mutex_unlock(&rw->lock);
+
+  if (!ok) {
+    return false;
+  }
+  gba_restore(gba, rw->current);
+  rw->counter = 0;
+  return true;
+}
+
+void rewind_reset(Rewind *rw) {
+  if (!rw->deltas) {
+    return;
+  }
+  pthread_mutex_lock(&rw->lock);
+  while (rw->pending) {
+    pthread_cond_wait(&rw->cond, &rw->lock);
+  }
+  while (rw->count > 0) {
+    drop_oldest(rw);
+  }
+  rw->has_current = false;
+  rw->counter = 0;
+  pthread_mutex_unlock(&rw->lock);
+}
+
+u32 rewind_count(Rewind *rw) {
+  pthread_mutex_lock(&rw->lock);
+  u32 count = rw->count;
+  pthread_mutex_unlock(&rw->lock);
+  return count;
+}
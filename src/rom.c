@@ -1,21 +1,63 @@
 #include "rom.h"
+#include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+// ROMs are mapped read-only rather than read in: pages are faulted in as
+// the game touches them and are shared with every other process and
+// instance running the same file. Reads past the end are the bus's
+// business, so nothing is padded.
 bool load_rom(Rom *rom, const char *filename) {
-  FILE *file = fopen(filename, "rb");
-  if (!file) {
+  memset(rom, 0, sizeof(Rom));
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
     return false;
   }
+  size_t size = MIN((size_t)st.st_size, ROM_MAX_SIZE);
+
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data != MAP_FAILED) {
+    rom->mapped = true;
+  } else {
+    // Not mappable on this filesystem: fall back to reading it in, rounded up
+    // like a mapping would be so aligned reads at the end stay in bounds.
+    data = calloc(1, (size + 3) & ~3);
+    bool ok = data && pread(fd, data, size, 0) == (ssize_t)size;
+    if (!ok) {
+      free(data);
+      close(fd);
+      return false;
+    }
+  }
+  close(fd);
 
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  rewind(file);
-  rom->data = malloc(ROM_MAX_SIZE);
-  size_t read = fread(rom->data, 1, file_size, file);
-  rom->size = (u32)file_size;
-  rom->title = strndup((char *)(rom->data + 0xA0), 12);
-  rom->code = strndup((char *)(rom->data + 0xAC), 4);
-  rom->maker = strndup((char *)(rom->data + 0xB0), 2);
-  fclose(file);
-  return read > 0;
+  rom->data = data;
+  rom->size = size;
+  rom->owned = true;
+  if (size >= 0xB2) {
+    memcpy(rom->title, rom->data + 0xA0, 12);
+    memcpy(rom->code, rom->data + 0xAC, 4);
+    memcpy(rom->maker, rom->data + 0xB0, 2);
+  }
+  rominfo_load(&rom->info, rom->data, rom->size);
+  return true;
+}
+
+void free_rom(Rom *rom) {
+  if (rom->owned && rom->data) {
+    if (rom->mapped) {
+      munmap(rom->data, rom->size);
+    } else {
+      free(rom->data);
+    }
+  }
+  rom->data = NULL;
 }
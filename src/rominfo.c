@@ -0,0 +1,258 @@
+#include "rominfo.h"
+#include "crc32.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_FILE "rominfo.idx"
+#define DATABASE_FILE "gamedb.txt"
+
+// The index holds scan results only, so bump this whenever the scan
+// changes to have every ROM rescanned.
+#define INDEX_MAGIC "GBAROMIX"
+#define INDEX_MAGIC_SIZE 8
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE (INDEX_MAGIC_SIZE + 8)
+
+// u32 crc, u32 size, u32 swi mask, u8 save type, 3 bytes reserved
+#define RECORD_SIZE 16
+
+static bool has_tag(const u8 *rom, u32 size, u32 i, const char *tag) {
+  size_t len = strlen(tag);
+  return i + len <= size && memcmp(rom + i, tag, len) == 0;
+}
+
+void rominfo_analyze(RomInfo *info, const u8 *rom, u32 size) {
+  // The save type comes from the library version strings the SDK links
+  // in. All tags are looked for in one pass, then ranked as before.
+  bool sram = false, flash64 = false, flash128 = false, eeprom = false;
+  for (u32 i = 0; i < size; i++) {
+    switch (rom[i]) {
+    case 'S':
+      sram |= has_tag(rom, size, i, "SRAM_");
+      break;
+    case 'F':
+      flash64 |= has_tag(rom, size, i, "FLASH_") ||
+                 has_tag(rom, size, i, "FLASH512_");
+      flash128 |= has_tag(rom, size, i, "FLASH1M_");
+      break;
+    case 'E':
+      eeprom |= has_tag(rom, size, i, "EEPROM_");
+      break;
+    }
+  }
+  if (sram) {
+    info->save_type = BACKUP_SRAM;
+  } else if (flash64) {
+    info->save_type = BACKUP_FLASH64;
+  } else if (flash128) {
+    info->save_type = BACKUP_FLASH128;
+  } else if (eeprom) {
+    info->save_type = BACKUP_EEPROM;
+  } else {
+    info->save_type = BACKUP_NONE;
+  }
+
+  // BIOS calls go through tiny wrappers, "swi n; bx lr", in either
+  // instruction set. Data rarely looks like that.
+  info->swi_mask = 0;
+  for (u32 i = 0; i + 4 <= size; i += 2) {
+    u16 op = get16(rom + i);
+    if ((op >> 8) == 0xDF && (op & 0xFF) < 32 &&
+        get16(rom + i + 2) == 0x4770) {
+      info->swi_mask |= 1u << (op & 0xFF);
+    }
+  }
+  for (u32 i = 0; i + 8 <= size; i += 4) {
+    u32 op = get32(rom + i);
+    if ((op & 0xFFE0FFFF) == 0xEF000000 &&
+        get32(rom + i + 4) == 0xE12FFF1E) {
+      info->swi_mask |= 1u << ((op >> 16) & 0x1F);
+    }
+  }
+}
+
+static bool use_database = true;
+
+void rominfo_use_database(bool use) { use_database = use; }
+
+static bool data_dir(char *out, size_t size) {
+  const char *dir = getenv("GBA_EMU_DIR");
+  const char *cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (dir && *dir) {
+    snprintf(out, size, "%s", dir);
+  } else if (cache && *cache) {
+    snprintf(out, size, "%s/gba-emu", cache);
+  } else if (home && *home) {
+    snprintf(out, size, "%s/.cache", home);
+    mkdir(out, 0755);
+    snprintf(out, size, "%s/.cache/gba-emu", home);
+  } else {
+    return false;
+  }
+  return mkdir(out, 0755) == 0 || errno == EEXIST;
+}
+
+// Returns the index contents, header included, or NULL if there's none.
+static u8 *read_index(const char *path, u32 *count) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  u8 *buf = size >= INDEX_HEADER_SIZE ? malloc(size) : NULL;
+  bool ok = buf && fread(buf, 1, size, file) == (size_t)size &&
+            memcmp(buf, INDEX_MAGIC, INDEX_MAGIC_SIZE) == 0 &&
+            get32(buf + INDEX_MAGIC_SIZE) == INDEX_VERSION;
+  fclose(file);
+  if (ok) {
+    *count = get32(buf + INDEX_MAGIC_SIZE + 4);
+    ok = *count <= (size - INDEX_HEADER_SIZE) / RECORD_SIZE;
+  }
+  if (!ok) {
+    free(buf);
+    return NULL;
+  }
+  return buf;
+}
+
+static bool lookup_index(const u8 *index, u32 count, u32 crc, u32 size,
+                         RomInfo *info) {
+  for (u32 i = 0; i < count; i++) {
+    const u8 *record = index + INDEX_HEADER_SIZE + i * RECORD_SIZE;
+    if (get32(record) == crc && get32(record + 4) == size &&
+        record[12] <= BACKUP_FLASH128) {
+      info->swi_mask = get32(record + 8);
+      info->save_type = record[12];
+      return true;
+    }
+  }
+  return false;
+}
+
+// Rewrites the index with one more record. The new file is renamed into
+// place, so a concurrent reader sees either version whole.
+static void append_index(const char *path, const u8 *index, u32 count,
+                         const RomInfo *info, u32 size) {
+  // A truncated template wouldn't end in XXXXXX.
+  char temp[4096 + 64];
+  if (snprintf(temp, sizeof(temp), "%s.XXXXXX", path) >= (int)sizeof(temp)) {
+    return;
+  }
+  int fd = mkstemp(temp);
+  if (fd < 0) {
+    return;
+  }
+  FILE *file = fdopen(fd, "wb");
+  if (!file) {
+    close(fd);
+    unlink(temp);
+    return;
+  }
+
+  u8 header[INDEX_HEADER_SIZE];
+  memcpy(header, INDEX_MAGIC, INDEX_MAGIC_SIZE);
+  put32(header + INDEX_MAGIC_SIZE, INDEX_VERSION);
+  put32(header + INDEX_MAGIC_SIZE + 4, count + 1);
+  u8 record[RECORD_SIZE] = {0};
+  put32(record, info->crc);
+  put32(record + 4, size);
+  put32(record + 8, info->swi_mask);
+  record[12] = info->save_type;
+
+  bool ok = fwrite(header, 1, INDEX_HEADER_SIZE, file) == INDEX_HEADER_SIZE;
+  if (count > 0) {
+    ok = ok && fwrite(index + INDEX_HEADER_SIZE, RECORD_SIZE, count, file) ==
+                   count;
+  }
+  ok = ok && fwrite(record, 1, RECORD_SIZE, file) == RECORD_SIZE;
+  ok &= fclose(file) == 0;
+  if (!ok || rename(temp, path) != 0) {
+    unlink(temp);
+  }
+}
+
+static bool parse_save_type(const char *name, BackupType *type) {
+  static const struct {
+    const char *name;
+    BackupType type;
+  } names[] = {
+      {"none", BACKUP_NONE},       {"sram", BACKUP_SRAM},
+      {"eeprom", BACKUP_EEPROM},   {"flash64", BACKUP_FLASH64},
+      {"flash128", BACKUP_FLASH128},
+  };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(name, names[i].name) == 0) {
+      *type = names[i].type;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void apply_database(const char *path, RomInfo *info) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return;
+  }
+  char line[1024];
+  for (int line_number = 1; fgets(line, sizeof(line), file); line_number++) {
+    char *save;
+    char *token = strtok_r(line, " \t\r\n", &save);
+    if (!token || token[0] == '#' ||
+        (u32)strtoul(token, NULL, 16) != info->crc) {
+      continue;
+    }
+    while ((token = strtok_r(NULL, " \t\r\n", &save))) {
+      char *value = strchr(token, '=');
+      if (!value) {
+        printf("%s:%d: expected key=value\n", path, line_number);
+        continue;
+      }
+      *value++ = '\0';
+      if (strcmp(token, "save") == 0) {
+        if (!parse_save_type(value, &info->save_type)) {
+          printf("%s:%d: unknown save type %s\n", path, line_number, value);
+        }
+      } else if (strcmp(token, "idle") == 0) {
+        info->idle_loop = strtoul(value, NULL, 0);
+      } else if (strcmp(token, "waitcnt") == 0) {
+        info->waitcnt = strtoul(value, NULL, 0);
+        info->has_waitcnt = true;
+      } else {
+        printf("%s:%d: unknown key %s\n", path, line_number, token);
+      }
+    }
+  }
+  fclose(file);
+}
+
+void rominfo_load(RomInfo *info, const u8 *rom, u32 size) {
+  memset(info, 0, sizeof(RomInfo));
+  info->crc = crc32(0, rom, size);
+
+  char dir[4096];
+  if (!data_dir(dir, sizeof(dir))) {
+    rominfo_analyze(info, rom, size);
+    return;
+  }
+  char path[4096 + 32];
+  snprintf(path, sizeof(path), "%s/%s", dir, INDEX_FILE);
+
+  u32 count = 0;
+  u8 *index = read_index(path, &count);
+  if (!index || !lookup_index(index, count, info->crc, size, info)) {
+    rominfo_analyze(info, rom, size);
+    append_index(path, index, index ? count : 0, info, size);
+  }
+  free(index);
+
+  if (use_database) {
+    snprintf(path, sizeof(path), "%s/%s", dir, DATABASE_FILE);
+    apply_database(path, info);
+  }
+}
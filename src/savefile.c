@@ -0,0 +1,141 @@
+#include "savefile.h"
+#include "gba.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Games write a save in many small pieces, and Flash erases first, so
+// this long without changes means the save is complete.
+#define FLUSH_DELAY_MS 1000
+
+static void *worker(void *arg) {
+  SaveFile *save = arg;
+  pthread_mutex_lock(&save->lock);
+  while (!save->quit) {
+    if (!save->pending) {
+      pthread_cond_wait(&save->cond, &save->lock);
+      continue;
+    }
+    struct timespec deadline = save->changed;
+    deadline.tv_sec += FLUSH_DELAY_MS / 1000;
+    deadline.tv_nsec += (FLUSH_DELAY_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec < deadline.tv_sec ||
+        (now.tv_sec == deadline.tv_sec && now.tv_nsec < deadline.tv_nsec)) {
+      // Woken early by a newer change or by close; look again either way.
+      pthread_cond_timedwait(&save->cond, &save->lock, &deadline);
+      continue;
+    }
+    save->pending = false;
+    pthread_mutex_unlock(&save->lock);
+    msync(save->map, save->size, MS_SYNC);
+    pthread_mutex_lock(&save->lock);
+  }
+  pthread_mutex_unlock(&save->lock);
+  return NULL;
+}
+
+bool savefile_open(SaveFile *save, Gba *gba, const char *path) {
+  memset(save, 0, sizeof(SaveFile));
+  save->fd = -1;
+  Backup *backup = &gba->backup;
+  if (backup->size == 0) {
+    return false;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    printf("Failed to open save file: %s\n", path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  u32 existing = MIN((u64)st.st_size, backup->size);
+  u8 *map = MAP_FAILED;
+  if ((u64)st.st_size >= backup->size || ftruncate(fd, backup->size) == 0) {
+    map = mmap(NULL, backup->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (map == MAP_FAILED) {
+    printf("Failed to map save file: %s\n", path);
+    close(fd);
+    return false;
+  }
+
+  // A shorter file, e.g. a 512 byte EEPROM save, fills the start and the
+  // rest stays erased.
+  memcpy(backup->data, map, existing);
+  dirty_mark_range(&gba->dirty, DIRTY_BACKUP, 0, existing);
+  memcpy(map + existing, backup->data + existing, backup->size - existing);
+
+  save->fd = fd;
+  save->map = map;
+  save->size = backup->size;
+  save->pending = existing < backup->size;
+  clock_gettime(CLOCK_MONOTONIC, &save->changed);
+  gba->unsaved = (BackupRange){0, 0};
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&save->lock, NULL);
+  pthread_cond_init(&save->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  if (pthread_create(&save->thread, NULL, worker, save) != 0) {
+    printf("Failed to start save file thread\n");
+    pthread_cond_destroy(&save->cond);
+    pthread_mutex_destroy(&save->lock);
+    munmap(map, save->size);
+    close(fd);
+    memset(save, 0, sizeof(SaveFile));
+    save->fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void savefile_close(SaveFile *save) {
+  if (!save->map) {
+    return;
+  }
+  pthread_mutex_lock(&save->lock);
+  save->quit = true;
+  pthread_cond_signal(&save->cond);
+  pthread_mutex_unlock(&save->lock);
+  pthread_join(save->thread, NULL);
+
+  msync(save->map, save->size, MS_SYNC);
+  munmap(save->map, save->size);
+  close(save->fd);
+  pthread_cond_destroy(&save->cond);
+  pthread_mutex_destroy(&save->lock);
+  memset(save, 0, sizeof(SaveFile));
+  save->fd = -1;
+}
+
+void savefile_sync(SaveFile *save, Gba *gba) {
+  BackupRange *unsaved = &gba->unsaved;
+  if (!save->map || unsaved->start >= unsaved->end) {
+    return;
+  }
+  u32 end = MIN(unsaved->end, save->size);
+  if (unsaved->start < end) {
+    memcpy(save->map + unsaved->start, gba->backup.data + unsaved->start,
+           end - unsaved->start);
+  }
+  *unsaved = (BackupRange){0, 0};
+
+  pthread_mutex_lock(&save->lock);
+  save->pending = true;
+  clock_gettime(CLOCK_MONOTONIC, &save->changed);
+  pthread_cond_signal(&save->cond);
+  pthread_mutex_unlock(&save->lock);
+}
@@ -0,0 +1,193 @@
+#include "savestate.h"
+#include "gba.h"
+#include "lz.h"
+#include <string.h>
+
+#define MAGIC "GBASTATE"
+#define MAGIC_SIZE 8
+#define HEADER_SIZE (MAGIC_SIZE + 8)
+#define CHUNK_HEADER_SIZE 12
+
+// Identifies the cartridge a state was made with.
+typedef struct {
+  char title[12];
+  char code[4];
+  u32 size;
+} RomId;
+
+typedef struct {
+  char id[4];
+  size_t offset; // into Gba, or SIZE_MAX for the ROM id
+  size_t size;
+} Chunk;
+
+static const Chunk chunks[] = {
+    {"ROM ", SIZE_MAX, sizeof(RomId)},
+    {"CPU ", offsetof(Gba, cpu), sizeof(Cpu)},
+    {"BUS ", offsetof(Gba, bus), sizeof(Bus)},
+    {"SCHD", offsetof(Gba, scheduler), sizeof(Scheduler)},
+    {"IO  ", offsetof(Gba, io), sizeof(Io)},
+    {"PPU ", offsetof(Gba, ppu), sizeof(Ppu)},
+    {"APU ", offsetof(Gba, apu), sizeof(Apu)},
+    {"INT ", offsetof(Gba, int_mgr), sizeof(InterruptManager)},
+    {"DMA ", offsetof(Gba, dma), sizeof(Dma)},
+    {"TMR ", offsetof(Gba, tmr_mgr), sizeof(TimerManager)},
+    {"EWRM", offsetof(Gba, ewram), sizeof(((Gba *)0)->ewram)},
+    {"IWRM", offsetof(Gba, iwram), sizeof(((Gba *)0)->iwram)},
+    {"BKUP", offsetof(Gba, backup), sizeof(Backup)},
+    {"KEYP", offsetof(Gba, keypad), sizeof(Keypad)},
+    {"FRAM", offsetof(Gba, frame_overshoot), sizeof(int)},
+};
+
+#define NUM_CHUNKS (sizeof(chunks) / sizeof(chunks[0]))
+
+static void rom_id(Gba *gba, RomId *id) {
+  memset(id, 0, sizeof(RomId));
+  memcpy(id->title, gba->rom.title, sizeof(id->title));
+  memcpy(id->code, gba->rom.code, sizeof(id->code));
+  id->size = gba->rom.size;
+}
+
+size_t savestate_bound(void) {
+  size_t size = HEADER_SIZE;
+  for (size_t i = 0; i < NUM_CHUNKS; i++) {
+    size += CHUNK_HEADER_SIZE + LZ_BOUND(chunks[i].size);
+  }
+  return size;
+}
+
+size_t savestate_save(Gba *gba, u8 *buf) {
+  RomId id;
+  rom_id(gba, &id);
+
+  memcpy(buf, MAGIC, MAGIC_SIZE);
+  put32(buf + MAGIC_SIZE, SAVESTATE_VERSION);
+  put32(buf + MAGIC_SIZE + 4, NUM_CHUNKS);
+  u8 *out = buf + HEADER_SIZE;
+
+  for (size_t i = 0; i < NUM_CHUNKS; i++) {
+    const Chunk *chunk = &chunks[i];
+    const u8 *data = chunk->offset == SIZE_MAX
+                         ? (const u8 *)&id
+                         : (const u8 *)gba + chunk->offset;
+
+    memcpy(out, chunk->id, 4);
+    put32(out + 4, chunk->size);
+    size_t compressed =
+        lz_compress(data, chunk->size, out + CHUNK_HEADER_SIZE);
+    put32(out + 8, compressed);
+    out += CHUNK_HEADER_SIZE + compressed;
+  }
+
+  return out - buf;
+}
+
+// Decodes into a copy of the current state so a bad file leaves the running
+// instance untouched.
+bool savestate_load(Gba *gba, const u8 *buf, size_t size) {
+  if (size < HEADER_SIZE || memcmp(buf, MAGIC, MAGIC_SIZE) != 0) {
+    printf("Not a save state\n");
+    return false;
+  }
+  u32 version = get32(buf + MAGIC_SIZE);
+  if (version != SAVESTATE_VERSION) {
+    printf("Unsupported save state version %u\n", version);
+    return false;
+  }
+  u32 count = get32(buf + MAGIC_SIZE + 4);
+
+  u8 *state = malloc(GBA_STATE_SIZE);
+  gba_snapshot(gba, state);
+
+  RomId expected, id;
+  rom_id(gba, &expected);
+  bool loaded[NUM_CHUNKS] = {false};
+  bool ok = true;
+
+  const u8 *in = buf + HEADER_SIZE;
+  const u8 *end = buf + size;
+  for (u32 n = 0; n < count && ok; n++) {
+    if (end - in < CHUNK_HEADER_SIZE) {
+      ok = false;
+      break;
+    }
+    u32 raw_size = get32(in + 4);
+    u32 compressed = get32(in + 8);
+    const u8 *data = in + CHUNK_HEADER_SIZE;
+    if ((size_t)(end - data) < compressed) {
+      ok = false;
+      break;
+    }
+
+    for (size_t i = 0; i < NUM_CHUNKS; i++) {
+      const Chunk *chunk = &chunks[i];
+      if (memcmp(in, chunk->id, 4) != 0) {
+        continue;
+      }
+      u8 *dest = chunk->offset == SIZE_MAX ? (u8 *)&id
+                                           : state + chunk->offset;
+      ok = raw_size == chunk->size &&
+           lz_decompress(data, compressed, dest, chunk->size);
+      loaded[i] = true;
+      break;
+    }
+    in = data + compressed;
+  }
+
+  for (size_t i = 0; i < NUM_CHUNKS && ok; i++) {
+    ok = loaded[i];
+  }
+  if (!ok) {
+    printf("Corrupt or incompatible save state\n");
+  } else if (memcmp(&id, &expected, sizeof(RomId)) != 0) {
+    printf("Save state is for a different ROM\n");
+    ok = false;
+  } else {
+    gba_restore(gba, state);
+  }
+
+  free(state);
+  return ok;
+}
+
+bool gba_save_state(Gba *gba, const char *path) {
+  u8 *buf = malloc(savestate_bound());
+  size_t size = savestate_save(gba, buf);
+
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    printf("Failed to open save state: %s\n", path);
+    free(buf);
+    return false;
+  }
+  bool ok = fwrite(buf, 1, size, file) == size;
+  ok &= fclose(file) == 0;
+  free(buf);
+  if (!ok) {
+    printf("Failed to write save state: %s\n", path);
+  }
+  return ok;
+}
+
+bool gba_load_state(Gba *gba, const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    printf("Failed to open save state: %s\n", path);
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  // ftell fails on what isn't a regular file.
+  u8 *buf = size >= HEADER_SIZE ? malloc(size) : NULL;
+  bool ok = buf && fread(buf, 1, size, file) == (size_t)size;
+  fclose(file);
+  if (!ok) {
+    printf("Failed to read save state: %s\n", path);
+  }
+
+  ok = ok && savestate_load(gba, buf, size);
+  free(buf);
+  return ok;
+}
@@ -1,71 +1,68 @@
 #include "scheduler.h"
+#include <string.h>
 
 void scheduler_init(Scheduler *scheduler) {
-  scheduler->head = NULL;
+  scheduler->count = 0;
   scheduler->current_time = 0;
 }
 
 void scheduler_push_event_ctx(Scheduler *scheduler, EventType type,
-                              uint time_from_now, void *ctx) {
-  Event *new_event = (Event *)malloc(sizeof(Event));
-  new_event->type = type;
-  new_event->scheduled_time = scheduler->current_time + time_from_now;
-  new_event->ctx = ctx;
-  new_event->next = NULL;
+                              uint time_from_now, int ctx) {
+  if (scheduler->count == SCHEDULER_MAX_EVENTS) {
+    // Dropping the event would silently hang or desync the machine.
+    printf("Scheduler full pushing event %d\n", type);
+    abort();
+  }
 
-  if (scheduler->head == NULL ||
-      (int)(scheduler->head->scheduled_time - new_event->scheduled_time) > 0) {
-    new_event->next = scheduler->head;
-    scheduler->head = new_event;
-  } else {
-    Event *current = scheduler->head;
-    while (current->next != NULL && (int)(new_event->scheduled_time -
-                                          current->next->scheduled_time) >= 0) {
-      current = current->next;
-    }
-    new_event->next = current->next;
-    current->next = new_event;
+  Event new_event = {
+      .type = type,
+      .scheduled_time = scheduler->current_time + time_from_now,
+      .ctx = ctx,
+  };
+
+  // Events due at the same time run in the order they were pushed, so the
+  // new event goes below (after) every event not due later than it.
+  int i = 0;
+  while (i < scheduler->count &&
+         (int)(scheduler->events[i].scheduled_time -
+               new_event.scheduled_time) > 0) {
+    i++;
   }
+  memmove(&scheduler->events[i + 1], &scheduler->events[i],
+          (scheduler->count - i) * sizeof(Event));
+  scheduler->events[i] = new_event;
+  scheduler->count++;
 }
 
 void scheduler_push_event(Scheduler *scheduler, EventType type,
                           uint time_from_now) {
-  scheduler_push_event_ctx(scheduler, type, time_from_now, NULL);
+  scheduler_push_event_ctx(scheduler, type, time_from_now, 0);
 }
 
-Event *scheduler_pop_event(Scheduler *scheduler) {
-  if (scheduler->head == NULL) {
-    return NULL;
+bool scheduler_pop_event(Scheduler *scheduler, Event *event) {
+  if (scheduler->count == 0) {
+    return false;
   }
-  Event *event = scheduler->head;
-  scheduler->head = scheduler->head->next;
-  return event;
+  *event = scheduler->events[--scheduler->count];
+  return true;
 }
 
-void scheduler_cancel_event(Scheduler *scheduler, EventType type, void *ctx) {
-  Event *current = scheduler->head;
-  Event *prev = NULL;
-
-  while (current != NULL) {
-    if (current->type == type && current->ctx == ctx) {
-      if (prev == NULL) {
-        scheduler->head = current->next;
-      } else {
-        prev->next = current->next;
-      }
-      free(current);
+void scheduler_cancel_event(Scheduler *scheduler, EventType type, int ctx) {
+  for (int i = scheduler->count - 1; i >= 0; i--) {
+    Event *event = &scheduler->events[i];
+    if (event->type == type && event->ctx == ctx) {
+      memmove(event, event + 1, (scheduler->count - i - 1) * sizeof(Event));
+      scheduler->count--;
       return;
     }
-    prev = current;
-    current = current->next;
   }
 }
 
 uint scheduler_peek_next_event_time(Scheduler *scheduler) {
-  if (scheduler->head == NULL) {
+  if (scheduler->count == 0) {
     return -1;
   }
-  return scheduler->head->scheduled_time;
+  return scheduler->events[scheduler->count - 1].scheduled_time;
 }
 
 void scheduler_step(Scheduler *scheduler, uint cycles) {
@@ -0,0 +1,180 @@
+#include "thread_pool.h"
+#include <string.h>
+#include <unistd.h>
+
+#define INITIAL_DEQUE_CAPACITY 64
+
+static bool deque_push(PoolDeque *deque, PoolItem item) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count == deque->capacity) {
+    u32 capacity = MAX(deque->capacity * 2, INITIAL_DEQUE_CAPACITY);
+    PoolItem *items = malloc(capacity * sizeof(PoolItem));
+    if (!items) {
+      pthread_mutex_unlock(&deque->lock);
+      return false;
+    }
+    for (u32 i = 0; i < deque->count; i++) {
+      items[i] = deque->items[(deque->head + i) & (deque->capacity - 1)];
+    }
+    free(deque->items);
+    deque->items = items;
+    deque->capacity = capacity;
+    deque->head = 0;
+  }
+  deque->items[(deque->head + deque->count) & (deque->capacity - 1)] = item;
+  deque->count++;
+  pthread_mutex_unlock(&deque->lock);
+  return true;
+}
+
+// The owner works newest first, thieves take the oldest.
+static bool deque_take(PoolDeque *deque, PoolItem *item, bool steal) {
+  pthread_mutex_lock(&deque->lock);
+  bool found = deque->count > 0;
+  if (found) {
+    if (steal) {
+      *item = deque->items[deque->head];
+      deque->head = (deque->head + 1) & (deque->capacity - 1);
+    } else {
+      *item = deque->items[(deque->head + deque->count - 1) &
+                           (deque->capacity - 1)];
+    }
+    deque->count--;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static bool take_task(ThreadPool *pool, int self, PoolItem *item) {
+  if (deque_take(&pool->deques[self], item, false)) {
+    return true;
+  }
+  for (int i = 1; i < pool->num_workers; i++) {
+    int victim = (self + i) % pool->num_workers;
+    if (deque_take(&pool->deques[victim], item, true)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *worker_main(void *arg) {
+  PoolWorker *worker = arg;
+  ThreadPool *pool = worker->pool;
+
+  while (true) {
+    PoolItem item;
+    if (take_task(pool, worker->index, &item)) {
+      pthread_mutex_lock(&pool->lock);
+      pool->queued--;
+      pthread_mutex_unlock(&pool->lock);
+
+      item.fn(item.arg);
+
+      pthread_mutex_lock(&pool->lock);
+      if (--pool->pending == 0) {
+        pthread_cond_broadcast(&pool->done);
+      }
+      pthread_mutex_unlock(&pool->lock);
+      continue;
+    }
+
+    // A task counted in `queued` may be mid-take by another worker; then
+    // this just looks again.
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued == 0 && !pool->quit) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    bool quit = pool->quit && pool->queued == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if (quit) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Stops and joins the first `started` workers, then frees everything.
+static void shutdown_pool(ThreadPool *pool, int started) {
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = true;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < started; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+
+  for (int i = 0; i < pool->num_workers; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].items);
+  }
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool->deques);
+  memset(pool, 0, sizeof(ThreadPool));
+}
+
+bool pool_init(ThreadPool *pool, int threads) {
+  memset(pool, 0, sizeof(ThreadPool));
+  if (threads <= 0) {
+    threads = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+  }
+
+  pool->workers = calloc(threads, sizeof(PoolWorker));
+  pool->deques = calloc(threads, sizeof(PoolDeque));
+  if (!pool->workers || !pool->deques) {
+    free(pool->workers);
+    free(pool->deques);
+    printf("Failed to allocate thread pool\n");
+    return false;
+  }
+  pool->num_workers = threads;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  for (int i = 0; i < threads; i++) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+  }
+
+  for (int i = 0; i < threads; i++) {
+    PoolWorker *worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i;
+    if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+      printf("Failed to start pool thread\n");
+      shutdown_pool(pool, i);
+      return false;
+    }
+  }
+  return true;
+}
+
+void pool_free(ThreadPool *pool) { shutdown_pool(pool, pool->num_workers); }
+
+void pool_submit(ThreadPool *pool, PoolTask fn, void *arg) {
+  // Held across the push so no worker can account for the task before
+  // it is counted.
+  pthread_mutex_lock(&pool->lock);
+  int target = pool->next;
+  pool->next = (pool->next + 1) % pool->num_workers;
+  if (!deque_push(&pool->deques[target], (PoolItem){fn, arg})) {
+    pthread_mutex_unlock(&pool->lock);
+    // Out of memory: run it here rather than lose it.
+    fn(arg);
+    return;
+  }
+  pool->queued++;
+  pool->pending++;
+  pthread_cond_signal(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(ThreadPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
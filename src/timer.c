@@ -1,4 +1,5 @@
 #include "timer.h"
+#include "apu.h"
 #include "gba.h"
 #include "interrupt.h"
 #include "scheduler.h"
@@ -6,20 +7,170 @@
 
 #define OVERFLOW 0x10000
 
+// Upper bound on the time between overflow events of a timer whose overflows
+// are not observed, so start_time never falls more than 2^31 cycles behind.
+#define MAX_BATCH_CYCLES (1 << 24)
+
+#define NEVER UINT64_MAX
+
 void timer_init(TimerManager *tmr_mgr) {
   memset(tmr_mgr, 0, sizeof(TimerManager));
 }
 
+static inline bool is_cascading(Timer *timer) {
+  return timer->control.enable && timer->control.cascade;
+}
+
+// A timer runs on the system clock when it is enabled and not cascading.
+// Timer 0 has no timer to cascade from, so with the cascade bit set it stops.
+static inline bool is_root(Timer *timer) {
+  return timer->control.enable && !timer->control.cascade;
+}
+
+// Overflows are observable when they raise an IRQ or drive a sound FIFO.
+// A cascading timer counts them, but that is handled in closed form.
+static bool is_observed(Gba *gba, int tmr) {
+  Timer *timer = &gba->tmr_mgr.timers[tmr];
+  return timer->control.irq || (tmr < 2 && apu_timer_in_use(&gba->apu, tmr));
+}
+
+static void overflow_effects(Gba *gba, int tmr, u64 overflows) {
+  Timer *timer = &gba->tmr_mgr.timers[tmr];
+
+  if (timer->control.irq) {
+    raise_interrupt(gba, INT_TIMER0 + tmr);
+  }
+
+  if (tmr < 2) {
+    for (u64 i = 0; i < overflows; i++) {
+      apu_on_timer_overflow(gba, tmr);
+    }
+  }
+}
+
+// Advances `ticks` counts on `timer`, returning the number of overflows.
+static u64 advance_count(Timer *timer, u64 ticks) {
+  u64 to_overflow = OVERFLOW - timer->count;
+  if (ticks < to_overflow) {
+    timer->count += ticks;
+    return 0;
+  }
+
+  u64 period = OVERFLOW - timer->reload_count;
+  ticks -= to_overflow;
+  timer->count = timer->reload_count + ticks % period;
+  return 1 + ticks / period;
+}
+
+static void cascade_overflows(Gba *gba, int tmr, u64 overflows) {
+  while (tmr < 3 && overflows > 0) {
+    Timer *next_timer = &gba->tmr_mgr.timers[tmr + 1];
+    if (!is_cascading(next_timer)) {
+      return;
+    }
+    overflows = advance_count(next_timer, overflows);
+    tmr++;
+    if (overflows > 0) {
+      overflow_effects(gba, tmr, overflows);
+    }
+  }
+}
+
+// Applies every overflow of a root timer up to `time`, including those of the
+// timers cascading from it.
+static void timer_catch_up(Gba *gba, int tmr, uint time) {
+  Timer *timer = &gba->tmr_mgr.timers[tmr];
+
+  // Still inside the start-up delay.
+  if ((int)(time - timer->start_time) < 0) {
+    return;
+  }
+
+  uint ticks = (time - timer->start_time) / timer->control.freq;
+  timer->start_time += ticks * timer->control.freq;
+
+  u64 overflows = advance_count(timer, ticks);
+  if (overflows > 0) {
+    overflow_effects(gba, tmr, overflows);
+    cascade_overflows(gba, tmr, overflows);
+  }
+}
+
+// Ticks of timer `tmr`'s input until the first observable overflow of it or
+// of a timer cascading from it.
+static u64 ticks_until_observed(Gba *gba, int tmr) {
+  Timer *timer = &gba->tmr_mgr.timers[tmr];
+  u64 to_overflow = OVERFLOW - timer->count;
+
+  if (is_observed(gba, tmr)) {
+    return to_overflow;
+  }
+  if (tmr == 3 || !is_cascading(&gba->tmr_mgr.timers[tmr + 1])) {
+    return NEVER;
+  }
+
+  u64 overflows = ticks_until_observed(gba, tmr + 1);
+  if (overflows == NEVER) {
+    return NEVER;
+  }
+  return to_overflow + (overflows - 1) * (OVERFLOW - timer->reload_count);
+}
+
+// Wakes the scheduler only when an overflow of the chain starting at root
+// timer `tmr` is observable, or after MAX_BATCH_CYCLES to rebase.
+static void timer_schedule(Gba *gba, int tmr) {
+  Timer *timer = &gba->tmr_mgr.timers[tmr];
+  uint now = gba->scheduler.current_time;
+
+  scheduler_cancel_event(&gba->scheduler, EVENT_TYPE_TIMER_OVERFLOW,
+                         tmr);
+
+  if (!is_root(timer)) {
+    return;
+  }
+
+  u64 ticks = ticks_until_observed(gba, tmr);
+  u64 cycles = MAX_BATCH_CYCLES;
+  if (ticks != NEVER) {
+    cycles = MIN(ticks * timer->control.freq, cycles);
+  }
+
+  uint due = timer->start_time + (uint)cycles;
+  int time_from_now = (int)(due - now);
+  scheduler_push_event_ctx(&gba->scheduler, EVENT_TYPE_TIMER_OVERFLOW,
+                           MAX(time_from_now, 0), tmr);
+}
+
+void timer_sync(Gba *gba) {
+  for (int tmr = 0; tmr < 4; tmr++) {
+    if (is_root(&gba->tmr_mgr.timers[tmr])) {
+      timer_catch_up(gba, tmr, gba->scheduler.current_time);
+    }
+  }
+}
+
+void timer_reschedule(Gba *gba) {
+  for (int tmr = 0; tmr < 4; tmr++) {
+    timer_schedule(gba, tmr);
+  }
+}
+
+void timer_reload_write(Gba *gba, int tmr, u16 val) {
+  timer_sync(gba);
+  gba->tmr_mgr.timers[tmr].reload_count = val;
+  timer_reschedule(gba);
+}
+
 void timer_control_write(Gba *gba, int tmr, u16 val) {
   TimerManager *tmr_mgr = &gba->tmr_mgr;
   Timer *timer = &tmr_mgr->timers[tmr];
   TimerControl *control = &timer->control;
 
-  bool was_enabled = control->enable;
+  timer_sync(gba);
 
-  if (was_enabled) {
-    timer->count = timer_get_count(gba, tmr);
-  }
+  bool was_enabled = control->enable;
+  bool was_root = is_root(timer);
+  int old_freq = control->freq;
 
   control->val = val;
   int freq = GET_BITS(val, 0, 2);
@@ -41,72 +192,46 @@ void timer_control_write(Gba *gba, int tmr, u16 val) {
   control->irq = TEST_BIT(val, 6);
   control->enable = TEST_BIT(val, 7);
 
-  scheduler_cancel_event(&gba->scheduler, EVENT_TYPE_TIMER_OVERFLOW,
-                         (void *)(intptr_t)tmr);
-
   if (!was_enabled && control->enable) {
     timer->start_time = gba->scheduler.current_time + 2;
     timer->count = timer->reload_count;
-
-    if (!control->cascade) {
-      int time_to_overflow = (OVERFLOW - timer->count) * control->freq;
-      scheduler_push_event_ctx(&gba->scheduler, EVENT_TYPE_TIMER_OVERFLOW,
-                               time_to_overflow + 2, (void *)(intptr_t)tmr);
-    }
+  } else if (is_root(timer) && (!was_root || control->freq != old_freq)) {
+    // A new clock source starts its prescaler from the already synced
+    // count. Rewriting the same prescaler keeps its phase.
+    timer->start_time = gba->scheduler.current_time;
   }
+
+  timer_reschedule(gba);
 }
 
 u16 timer_get_count(Gba *gba, int tmr) {
-  TimerManager *tmr_mgr = &gba->tmr_mgr;
-  Timer *timer = &tmr_mgr->timers[tmr];
-  TimerControl *control = &timer->control;
+  Timer *timer = &gba->tmr_mgr.timers[tmr];
 
-  if (!control->enable) {
+  if (!timer->control.enable) {
     return timer->count;
   }
 
-  if (control->cascade) {
+  // Cascading counts are only materialised when their root catches up.
+  if (timer->control.cascade) {
+    timer_sync(gba);
     return timer->count;
   }
 
-  uint elapsed_cycles = gba->scheduler.current_time - timer->start_time;
-  uint increments = elapsed_cycles / control->freq;
-
-  uint current_count = timer->count + increments;
+  uint now = gba->scheduler.current_time;
+  if ((int)(now - timer->start_time) < 0) {
+    return timer->count;
+  }
 
-  if (current_count >= OVERFLOW) {
-    return timer->reload_count + (current_count - OVERFLOW);
-  } else {
-    return (u16)current_count;
+  u64 ticks = (now - timer->start_time) / timer->control.freq;
+  u64 to_overflow = OVERFLOW - timer->count;
+  if (ticks < to_overflow) {
+    return timer->count + ticks;
   }
+  return timer->reload_count +
+         (ticks - to_overflow) % (OVERFLOW - timer->reload_count);
 }
 
 void timer_overflow(Gba *gba, int tmr, uint lateness) {
-  TimerManager *tmr_mgr = &gba->tmr_mgr;
-  Timer *timer = &tmr_mgr->timers[tmr];
-  TimerControl *control = &timer->control;
-
-  timer->count = timer->reload_count;
-
-  if (control->irq) {
-    raise_interrupt(gba, INT_TIMER0 + tmr);
-  }
-
-  timer->start_time = gba->scheduler.current_time - lateness;
-
-  if (!control->cascade) {
-    int time_to_overflow = (OVERFLOW - timer->count) * control->freq - lateness;
-    scheduler_push_event_ctx(&gba->scheduler, EVENT_TYPE_TIMER_OVERFLOW,
-                             time_to_overflow, (void *)(intptr_t)tmr);
-  }
-
-  if (tmr < 3) {
-    Timer *next_timer = &tmr_mgr->timers[tmr + 1];
-    if (next_timer->control.enable && next_timer->control.cascade) {
-      next_timer->count++;
-      if (next_timer->count == 0) {
-        timer_overflow(gba, tmr + 1, lateness);
-      }
-    }
-  }
+  timer_catch_up(gba, tmr, gba->scheduler.current_time - lateness);
+  timer_schedule(gba, tmr);
 }
@@ -0,0 +1,137 @@
+#include "vecenv.h"
+#include "apu.h"
+#include "gba.h"
+#include <string.h>
+
+static void copy_ram(VecEnv *env, int i) {
+  Gba *gba = env->envs[i];
+  u8 *ram = env->ram + (size_t)i * VECENV_RAM_SIZE;
+  memcpy(ram, gba->ewram, sizeof(gba->ewram));
+  memcpy(ram + sizeof(gba->ewram), gba->iwram, sizeof(gba->iwram));
+}
+
+// The start state's internal framebuffer holds the frame the source showed
+// when the batch was made, which is what a fresh episode observes.
+static void reset_env(VecEnv *env, int i) {
+  Gba *gba = env->envs[i];
+  gba_restore(gba, env->start);
+  memcpy(env->observations + i * env->observation_size, gba->ppu.framebuffer,
+         env->observation_size);
+  copy_ram(env, i);
+  env->done[i] = false;
+  env->episode_frames[i] = 0;
+}
+
+static void step_env(void *arg) {
+  VecEnvTask *task = arg;
+  VecEnv *env = task->env;
+  int i = task->index;
+  Gba *gba = env->envs[i];
+
+  if (env->done[i]) {
+    reset_env(env, i);
+  }
+  gba->keypad.keyinput = env->actions[i] & 0x3FF;
+  for (int frame = 0; frame < env->frames_per_step; frame++) {
+    ppu_set_skip_video(gba, frame < env->frames_per_step - 1);
+    gba_run_frame(gba);
+  }
+  ppu_set_skip_video(gba, false);
+  copy_ram(env, i);
+
+  env->episode_frames[i] += env->frames_per_step;
+  env->done[i] = (env->max_frames > 0 &&
+                  env->episode_frames[i] >= (u32)env->max_frames) ||
+                 (env->done_fn && env->done_fn(gba, env->done_ctx));
+}
+
+bool vecenv_init(VecEnv *env, Gba *source, int num_envs, int threads) {
+  memset(env, 0, sizeof(VecEnv));
+  if (num_envs <= 0) {
+    return false;
+  }
+  env->num_envs = num_envs;
+  env->observation_size = PIXELS_WIDTH * PIXELS_HEIGHT *
+                          ppu_bytes_per_pixel(source->video_format);
+
+  env->envs = calloc(num_envs, sizeof(Gba *));
+  env->tasks = calloc(num_envs, sizeof(VecEnvTask));
+  env->start = malloc(GBA_STATE_SIZE);
+  env->observations = malloc(num_envs * env->observation_size);
+  env->ram = malloc((size_t)num_envs * VECENV_RAM_SIZE);
+  env->done = calloc(num_envs, sizeof(bool));
+  env->episode_frames = calloc(num_envs, sizeof(u32));
+  bool ok = env->envs && env->tasks && env->start && env->observations &&
+            env->ram && env->done && env->episode_frames;
+  for (int i = 0; ok && i < num_envs; i++) {
+    // Allocated one by one so instances on different cores don't share
+    // cache lines.
+    env->envs[i] = malloc(sizeof(Gba));
+    ok = env->envs[i] != NULL;
+  }
+  if (!ok) {
+    printf("Failed to allocate %d environments\n", num_envs);
+    vecenv_free(env);
+    return false;
+  }
+  if (!pool_init(&env->pool, threads)) {
+    memset(&env->pool, 0, sizeof(ThreadPool));
+    vecenv_free(env);
+    return false;
+  }
+
+  // Rendering into the internal framebuffer keeps the shown frame in the
+  // state. The instances render straight into their observation instead,
+  // so the start state gets the frame a frontend buffer holds.
+  int pitch = env->observation_size / PIXELS_HEIGHT;
+  gba_snapshot(source, env->start);
+  if (source->video_output) {
+    u8 *framebuffer = (u8 *)((Gba *)env->start)->ppu.framebuffer;
+    for (int y = 0; y < PIXELS_HEIGHT; y++) {
+      memcpy(framebuffer + y * pitch,
+             (u8 *)source->video_output + y * source->video_pitch, pitch);
+    }
+  }
+  for (int i = 0; i < num_envs; i++) {
+    Gba *gba = env->envs[i];
+    gba_clone(gba, source);
+    apu_set_synthesize(gba, false);
+    ppu_set_output(gba, env->observations + i * env->observation_size, pitch);
+    env->tasks[i] = (VecEnvTask){env, i};
+    reset_env(env, i);
+  }
+  return true;
+}
+
+void vecenv_free(VecEnv *env) {
+  if (env->pool.workers) {
+    pool_free(&env->pool);
+  }
+  for (int i = 0; env->envs && i < env->num_envs; i++) {
+    free(env->envs[i]);
+  }
+  free(env->envs);
+  free(env->tasks);
+  free(env->start);
+  free(env->observations);
+  free(env->ram);
+  free(env->done);
+  free(env->episode_frames);
+  memset(env, 0, sizeof(VecEnv));
+}
+
+void vecenv_reset(VecEnv *env) {
+  for (int i = 0; i < env->num_envs; i++) {
+    reset_env(env, i);
+  }
+}
+
+void vecenv_step(VecEnv *env, const u16 *actions, int frames_per_step) {
+  env->actions = actions;
+  env->frames_per_step = MAX(frames_per_step, 1);
+  for (int i = 0; i < env->num_envs; i++) {
+    pool_submit(&env->pool, step_env, &env->tasks[i]);
+  }
+  pool_wait(&env->pool);
+  env->actions = NULL;
+}
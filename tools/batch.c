@@ -0,0 +1,285 @@
+#include "apu.h"
+#include "common.h"
+#include "crc32.h"
+#include "gba.h"
+#include "movie.h"
+#include "rominfo.h"
+#include "thread_pool.h"
+#include "util.h"
+#include <string.h>
+
+// Runs many independent jobs in one process across a work-stealing pool.
+// Each distinct ROM, movie and the BIOS are loaded once and shared
+// read-only by every instance that uses them.
+//
+// The manifest has one job per line, paths relative to the manifest:
+//
+//   <rom> <movie or -> [frames]
+//
+// Blank lines and lines starting with '#' are ignored. Without a movie the
+// frame count is required.
+
+#define MAX_NAME 1024
+
+typedef struct {
+  char path[4096];
+  Rom rom;
+  bool loaded;
+} SharedRom;
+
+typedef struct {
+  char path[4096];
+  Movie movie;
+  bool loaded;
+} SharedMovie;
+
+typedef struct {
+  char name[MAX_NAME * 2 + 1];
+  const u8 *bios;
+  const Rom *rom;
+  const Movie *movie; // NULL to run without input
+  u32 frames;
+  bool audio;
+  bool fast_boot;
+
+  // Results
+  bool ok;
+  u32 frames_run;
+  double seconds;
+  u32 frame_crc;
+} Job;
+
+static void run_job(void *arg) {
+  Job *job = arg;
+  Gba *gba = malloc(sizeof(Gba));
+  if (!gba) {
+    return;
+  }
+  gba_init_shared(gba, job->bios, job->rom);
+  if (job->fast_boot) {
+    gba_skip_bios(gba);
+  }
+  apu_set_synthesize(gba, job->audio);
+
+  // Playback only advances the copy's position; the input log is shared.
+  Movie movie;
+  if (job->movie) {
+    movie = *job->movie;
+    if (!movie_play_start(&movie, gba)) {
+      gba_free(gba);
+      free(gba);
+      return;
+    }
+  }
+
+  double start = now_seconds();
+  u32 frame = 0;
+  for (; frame < job->frames; frame++) {
+    if (job->movie && !movie_play_frame(&movie, gba)) {
+      break;
+    }
+    gba_run_frame(gba);
+    apu_sync(gba);
+    s16 samples[APU_BUFFER_SIZE * 2];
+    apu_read_samples(gba, samples, APU_BUFFER_SIZE);
+  }
+  job->seconds = now_seconds() - start;
+  job->frames_run = frame;
+  job->frame_crc = crc32(0, (const u8 *)gba->ppu.framebuffer,
+                         sizeof(gba->ppu.framebuffer));
+  job->ok = true;
+
+  gba_free(gba);
+  free(gba);
+}
+
+// Entries are allocated one by one since jobs keep pointers into them.
+static const Rom *find_rom(SharedRom ***roms, int *count, const char *path) {
+  for (int i = 0; i < *count; i++) {
+    if (strcmp((*roms)[i]->path, path) == 0) {
+      return (*roms)[i]->loaded ? &(*roms)[i]->rom : NULL;
+    }
+  }
+  *roms = realloc(*roms, (*count + 1) * sizeof(SharedRom *));
+  SharedRom *entry = calloc(1, sizeof(SharedRom));
+  (*roms)[(*count)++] = entry;
+  snprintf(entry->path, sizeof(entry->path), "%s", path);
+  entry->loaded = load_rom(&entry->rom, path);
+  if (!entry->loaded) {
+    printf("Failed to load ROM: %s\n", path);
+    return NULL;
+  }
+  return &entry->rom;
+}
+
+static const Movie *find_movie(SharedMovie ***movies, int *count,
+                               const char *path) {
+  for (int i = 0; i < *count; i++) {
+    if (strcmp((*movies)[i]->path, path) == 0) {
+      return (*movies)[i]->loaded ? &(*movies)[i]->movie : NULL;
+    }
+  }
+  *movies = realloc(*movies, (*count + 1) * sizeof(SharedMovie *));
+  SharedMovie *entry = calloc(1, sizeof(SharedMovie));
+  (*movies)[(*count)++] = entry;
+  snprintf(entry->path, sizeof(entry->path), "%s", path);
+  entry->loaded = movie_load(&entry->movie, path);
+  return entry->loaded ? &entry->movie : NULL;
+}
+
+int main(int argc, char *argv[]) {
+  char *manifest_file = NULL;
+  char *bios_file = "gba_bios.bin";
+  int threads = 0;
+  int repeat = 1;
+  bool audio = true;
+  bool fast_boot = false;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--bios=", 7) == 0) {
+      bios_file = argv[i] + 7;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      threads = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+      repeat = atoi(argv[i] + 9);
+      usage |= repeat <= 0;
+    } else if (strcmp(argv[i], "--no-audio") == 0) {
+      audio = false;
+    } else if (strcmp(argv[i], "--no-gamedb") == 0) {
+      rominfo_use_database(false);
+    } else if (strcmp(argv[i], "--fast-boot") == 0) {
+      fast_boot = true;
+    } else if (argv[i][0] == '-' || manifest_file) {
+      usage = true;
+    } else {
+      manifest_file = argv[i];
+    }
+  }
+  if (usage || !manifest_file) {
+    printf("Usage: %s [--bios=file] [--threads=N] [--repeat=N] [--no-audio] "
+           "[--fast-boot] [--no-gamedb] <manifest>\n",
+           argv[0]);
+    return 2;
+  }
+
+  static u8 bios[0x4000];
+  if (!load_bios(bios, bios_file)) {
+    printf("Failed to load BIOS: %s\n", bios_file);
+    return 2;
+  }
+
+  FILE *manifest = fopen(manifest_file, "r");
+  if (!manifest) {
+    printf("Failed to open manifest: %s\n", manifest_file);
+    return 2;
+  }
+  char dir[4096];
+  snprintf(dir, sizeof(dir), "%s", manifest_file);
+  char *slash = strrchr(dir, '/');
+  if (slash) {
+    *slash = '\0';
+  } else {
+    dir[0] = '\0';
+  }
+
+  SharedRom **roms = NULL;
+  SharedMovie **movies = NULL;
+  int num_roms = 0, num_movies = 0;
+  Job *jobs = NULL;
+  int num_jobs = 0;
+  int failed = 0;
+
+  char line[4096];
+  for (int line_number = 1; fgets(line, sizeof(line), manifest);
+       line_number++) {
+    char rom_name[MAX_NAME], movie_name[MAX_NAME];
+    u32 frames = 0;
+    int fields =
+        sscanf(line, "%1023s %1023s %u", rom_name, movie_name, &frames);
+    if (fields <= 0 || rom_name[0] == '#') {
+      continue;
+    }
+    bool has_movie = fields >= 2 && strcmp(movie_name, "-") != 0;
+    if (fields < 2 || (!has_movie && frames == 0)) {
+      printf("%s:%d: expected <rom> <movie or -> [frames]\n", manifest_file,
+             line_number);
+      failed++;
+      continue;
+    }
+
+    char path[4096];
+    resolve(path, sizeof(path), dir, rom_name);
+    const Rom *rom = find_rom(&roms, &num_roms, path);
+    const Movie *movie = NULL;
+    if (has_movie) {
+      resolve(path, sizeof(path), dir, movie_name);
+      movie = find_movie(&movies, &num_movies, path);
+    }
+    if (!rom || (has_movie && !movie)) {
+      failed += repeat;
+      continue;
+    }
+
+    jobs = realloc(jobs, (num_jobs + repeat) * sizeof(Job));
+    for (int i = 0; i < repeat; i++) {
+      Job *job = &jobs[num_jobs++];
+      memset(job, 0, sizeof(Job));
+      snprintf(job->name, sizeof(job->name), "%s%s%s", rom_name,
+               has_movie ? " " : "", has_movie ? movie_name : "");
+      job->bios = bios;
+      job->rom = rom;
+      job->movie = movie;
+      job->frames = frames > 0 ? frames : movie->frame_count;
+      job->audio = audio;
+      job->fast_boot = fast_boot;
+    }
+  }
+  fclose(manifest);
+
+  ThreadPool pool;
+  if (!pool_init(&pool, threads)) {
+    return 2;
+  }
+  double start = now_seconds();
+  for (int i = 0; i < num_jobs; i++) {
+    pool_submit(&pool, run_job, &jobs[i]);
+  }
+  pool_wait(&pool);
+  double elapsed = now_seconds() - start;
+  int workers = pool.num_workers;
+  pool_free(&pool);
+
+  u64 total_frames = 0;
+  for (int i = 0; i < num_jobs; i++) {
+    Job *job = &jobs[i];
+    if (!job->ok) {
+      printf("FAIL %s\n", job->name);
+      failed++;
+      continue;
+    }
+    total_frames += job->frames_run;
+    printf("%-40s frames %6u time %7.3f s fps %8.1f crc %08x\n", job->name,
+           job->frames_run, job->seconds,
+           job->frames_run / MAX(job->seconds, 1e-9), job->frame_crc);
+  }
+  printf("%d jobs on %d threads, %llu frames in %.3f s: %.1f fps total\n",
+         num_jobs, workers, (unsigned long long)total_frames, elapsed,
+         total_frames / MAX(elapsed, 1e-9));
+
+  for (int i = 0; i < num_movies; i++) {
+    if (movies[i]->loaded) {
+      movie_free(&movies[i]->movie);
+    }
+    free(movies[i]);
+  }
+  for (int i = 0; i < num_roms; i++) {
+    if (roms[i]->loaded) {
+      free_rom(&roms[i]->rom);
+    }
+    free(roms[i]);
+  }
+  free(movies);
+  free(roms);
+  free(jobs);
+  return failed > 0;
+}
@@ -0,0 +1,301 @@
+#include "apu.h"
+#include "common.h"
+#include "crc32.h"
+#include "gba.h"
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Boots a ROM once, runs it to a warm-up point, then serves jobs over a
+// Unix socket. Every connection is handled by a forked child that starts
+// from the warmed instance, its ROM mapping and decode tables shared
+// copy-on-write, so a job starts in the time a fork takes.
+//
+// A connection carries one request line:
+//
+//   <frames> [<frame>:<keyinput> ...]
+//
+// where each event sets KEYINPUT (hex, active low) before the given frame,
+// counted from the start of the job, in ascending order and below <frames>.
+// <frames> is capped by --max-frames, and at most --max-jobs children run
+// at once; further connections wait in the listen backlog.
+// The reply is
+//
+//   ok frames <n> crc <framebuffer crc> pc <pc>
+//
+// or "error <message>". For example:
+//
+//   echo "600 0:3f7 10:3ff" | socat - UNIX-CONNECT:gba-forkserver.sock
+
+#define DEFAULT_SOCKET "gba-forkserver.sock"
+#define DEFAULT_PC_FRAMES 3600
+#define DEFAULT_MAX_FRAMES (60 * 60 * 60) // an hour of game time
+// A client that doesn't send its request line in time gives its slot up.
+#define REQUEST_TIMEOUT_SECONDS 10
+
+typedef struct {
+  u32 frame;
+  u16 keys;
+} KeyEvent;
+
+// Parses all of `text` as a number no larger than `max`.
+static bool parse_u32(const char *text, int base, u32 max, u32 *out) {
+  char *end;
+  errno = 0;
+  unsigned long value = strtoul(text, &end, base);
+  if (end == text || *end != '\0' || errno != 0 || value > max) {
+    return false;
+  }
+  *out = value;
+  return true;
+}
+
+// Returns an error message, or NULL once the reply has been sent.
+static const char *run_job(Gba *gba, char *line, u32 max_frames, int out) {
+  char *save;
+  char *token = strtok_r(line, " \t\r\n", &save);
+  u32 frames;
+  if (!token || !parse_u32(token, 0, UINT32_MAX, &frames) || frames == 0) {
+    return "expected <frames> [<frame>:<keyinput> ...]";
+  }
+  if (frames > max_frames) {
+    return "too many frames";
+  }
+
+  KeyEvent *events = NULL;
+  u32 count = 0;
+  while ((token = strtok_r(NULL, " \t\r\n", &save))) {
+    KeyEvent event;
+    u32 keys = 0;
+    char *colon = strchr(token, ':');
+    if (colon) {
+      *colon = '\0';
+    }
+    const char *error = NULL;
+    if (!colon || !parse_u32(token, 0, UINT32_MAX, &event.frame) ||
+        !parse_u32(colon + 1, 16, 0x3FF, &keys)) {
+      error = "bad event";
+    } else if (event.frame >= frames) {
+      error = "event past the last frame";
+    } else if (count > 0 && event.frame < events[count - 1].frame) {
+      error = "events out of order";
+    }
+    if (error) {
+      free(events);
+      return error;
+    }
+    event.keys = keys;
+    KeyEvent *grown = realloc(events, (count + 1) * sizeof(KeyEvent));
+    if (!grown) {
+      free(events);
+      return "out of memory";
+    }
+    events = grown;
+    events[count++] = event;
+  }
+
+  u32 next = 0;
+  for (u32 frame = 0; frame < frames; frame++) {
+    for (; next < count && events[next].frame == frame; next++) {
+      gba->keypad.keyinput = events[next].keys;
+    }
+    gba_run_frame(gba);
+    apu_sync(gba);
+    s16 samples[APU_BUFFER_SIZE * 2];
+    apu_read_samples(gba, samples, APU_BUFFER_SIZE);
+  }
+  free(events);
+
+  u32 frame_crc = crc32(0, (const u8 *)gba->ppu.framebuffer,
+                        sizeof(gba->ppu.framebuffer));
+  dprintf(out, "ok frames %u crc %08x pc %08x\n", frames, frame_crc,
+          gba->cpu.regs[15]);
+  return NULL;
+}
+
+// Runs in the forked child.
+static void serve(Gba *gba, int conn, u32 max_frames) {
+  struct timeval timeout = {REQUEST_TIMEOUT_SECONDS, 0};
+  setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  FILE *in = fdopen(conn, "r");
+  char *line = NULL;
+  size_t capacity = 0;
+  if (in && getline(&line, &capacity, in) >= 0) {
+    const char *error = run_job(gba, line, max_frames, conn);
+    if (error) {
+      dprintf(conn, "error %s\n", error);
+    }
+  }
+  free(line);
+  if (in) {
+    fclose(in);
+  }
+}
+
+static int listen_on(const char *path) {
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    printf("Socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    printf("Failed to create socket: %s\n", strerror(errno));
+    return -1;
+  }
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    printf("Failed to listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char *argv[]) {
+  char *rom_file = NULL;
+  char *bios_file = "gba_bios.bin";
+  char *socket_path = DEFAULT_SOCKET;
+  u32 frames = 0;
+  bool has_frames = false;
+  u32 max_frames = DEFAULT_MAX_FRAMES;
+  u32 max_jobs = 0;
+  u32 stop_pc = 0;
+  bool has_pc = false;
+  bool audio = true;
+  bool fast_boot = false;
+  int positional = 0;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--socket=", 9) == 0) {
+      socket_path = argv[i] + 9;
+    } else if (strncmp(argv[i], "--frames=", 9) == 0) {
+      has_frames = true;
+      usage |= !parse_u32(argv[i] + 9, 10, INT32_MAX, &frames);
+    } else if (strncmp(argv[i], "--pc=", 5) == 0) {
+      has_pc = true;
+      usage |= !parse_u32(argv[i] + 5, 16, UINT32_MAX, &stop_pc);
+    } else if (strncmp(argv[i], "--max-frames=", 13) == 0) {
+      usage |= !parse_u32(argv[i] + 13, 10, UINT32_MAX, &max_frames) ||
+               max_frames == 0;
+    } else if (strncmp(argv[i], "--max-jobs=", 11) == 0) {
+      usage |= !parse_u32(argv[i] + 11, 10, INT32_MAX, &max_jobs) ||
+               max_jobs == 0;
+    } else if (strcmp(argv[i], "--no-audio") == 0) {
+      audio = false;
+    } else if (strcmp(argv[i], "--fast-boot") == 0) {
+      fast_boot = true;
+    } else if (argv[i][0] == '-') {
+      usage = true;
+    } else if (positional == 0) {
+      rom_file = argv[i];
+      positional++;
+    } else if (positional == 1) {
+      bios_file = argv[i];
+      positional++;
+    } else {
+      usage = true;
+    }
+  }
+  // Looking for the PC needs at least one frame to look in.
+  usage |= has_pc && has_frames && frames == 0;
+  if (usage || !rom_file) {
+    printf("Usage: %s [--socket=path] [--frames=N] [--pc=hex] "
+           "[--max-frames=N] [--max-jobs=N] [--no-audio] [--fast-boot] "
+           "<rom_file> [bios_file]\n"
+           "Warms up for N frames, or until the PC is reached within N "
+           "frames. Jobs run at most --max-frames frames (default %d), "
+           "--max-jobs at a time (default one per online CPU).\n",
+           argv[0], DEFAULT_MAX_FRAMES);
+    return 1;
+  }
+
+  Gba *gba = malloc(sizeof(Gba));
+  if (!gba_init(gba, bios_file, rom_file)) {
+    gba_free(gba);
+    free(gba);
+    return 1;
+  }
+  if (fast_boot) {
+    gba_skip_bios(gba);
+  }
+  apu_set_synthesize(gba, audio);
+
+  if (has_pc) {
+    if (!gba_run_to_pc(gba, stop_pc, has_frames ? frames : DEFAULT_PC_FRAMES)) {
+      printf("PC %08x not reached\n", stop_pc);
+      gba_free(gba);
+      free(gba);
+      return 1;
+    }
+  } else {
+    for (u32 i = 0; i < frames; i++) {
+      gba_run_frame(gba);
+    }
+  }
+  // Children start with an empty sample buffer.
+  apu_sync(gba);
+  s16 samples[APU_BUFFER_SIZE * 2];
+  while (apu_read_samples(gba, samples, APU_BUFFER_SIZE) > 0) {
+  }
+
+  int listen_fd = listen_on(socket_path);
+  if (listen_fd < 0) {
+    gba_free(gba);
+    free(gba);
+    return 1;
+  }
+
+  if (max_jobs == 0) {
+    max_jobs = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+  }
+  // A client that hangs up early only fails the write.
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("listening on %s, pc %08x\n", socket_path, gba->cpu.regs[15]);
+  fflush(stdout);
+
+  u32 live = 0;
+  while (true) {
+    // Finished children are reaped as they go; at the limit the next
+    // connection isn't accepted until one finishes.
+    while (live > 0 && waitpid(-1, NULL, live < max_jobs ? WNOHANG : 0) > 0) {
+      live--;
+    }
+    int conn = accept(listen_fd, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      printf("accept failed: %s\n", strerror(errno));
+      break;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(listen_fd);
+      serve(gba, conn, max_frames);
+      _exit(0);
+    }
+    if (pid < 0) {
+      dprintf(conn, "error fork failed: %s\n", strerror(errno));
+    } else {
+      live++;
+    }
+    close(conn);
+  }
+
+  close(listen_fd);
+  unlink(socket_path);
+  gba_free(gba);
+  free(gba);
+  return 1;
+}
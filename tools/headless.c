@@ -0,0 +1,194 @@
+#include "apu.h"
+#include "checkpoint.h"
+#include "common.h"
+#include "crc32.h"
+#include "gba.h"
+#include "movie.h"
+#include "rominfo.h"
+#include "util.h"
+#include <string.h>
+
+// Runs a ROM without a window or audio device, as fast as it will go. With
+// a movie it replays the recorded input, so two runs do identical work and
+// end on the same frame; the final frame's CRC shows that they did.
+
+#define DEFAULT_FRAMES 3600
+
+// Checkpoints every ten seconds, a full one every few minutes, and the file
+// is started over once it passes the size limit.
+#define CHECKPOINT_INTERVAL 600
+#define CHECKPOINT_FULL_INTERVAL 16
+#define CHECKPOINT_MAX_BYTES (256 * 1024 * 1024)
+
+static bool parse_format(const char *name, PixelFormat *format) {
+  static const struct {
+    const char *name;
+    PixelFormat format;
+  } names[] = {
+      {"argb8888", PIXEL_FORMAT_ARGB8888},
+      {"rgb565", PIXEL_FORMAT_RGB565},
+      {"bgr555", PIXEL_FORMAT_BGR555},
+  };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(name, names[i].name) == 0) {
+      *format = names[i].format;
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char *argv[]) {
+  char *rom_file = NULL;
+  char *bios_file = "gba_bios.bin";
+  char *movie_file = NULL;
+  char *checkpoint_file = NULL;
+  char *resume_file = NULL;
+  PixelFormat format = PIXEL_FORMAT_ARGB8888;
+  long frames = -1;
+  bool audio = true;
+  bool info = false;
+  bool fast_boot = false;
+  int positional = 0;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--frames=", 9) == 0) {
+      frames = atol(argv[i] + 9);
+      usage |= frames <= 0;
+    } else if (strncmp(argv[i], "--movie=", 8) == 0) {
+      movie_file = argv[i] + 8;
+    } else if (strncmp(argv[i], "--checkpoint=", 13) == 0) {
+      checkpoint_file = argv[i] + 13;
+    } else if (strncmp(argv[i], "--resume=", 9) == 0) {
+      resume_file = argv[i] + 9;
+    } else if (strncmp(argv[i], "--format=", 9) == 0) {
+      usage |= !parse_format(argv[i] + 9, &format);
+    } else if (strcmp(argv[i], "--no-audio") == 0) {
+      audio = false;
+    } else if (strcmp(argv[i], "--no-gamedb") == 0) {
+      rominfo_use_database(false);
+    } else if (strcmp(argv[i], "--fast-boot") == 0) {
+      fast_boot = true;
+    } else if (strcmp(argv[i], "--info") == 0) {
+      info = true;
+    } else if (argv[i][0] == '-') {
+      usage = true;
+    } else if (positional == 0) {
+      rom_file = argv[i];
+      positional++;
+    } else if (positional == 1) {
+      bios_file = argv[i];
+      positional++;
+    } else {
+      usage = true;
+    }
+  }
+  // Checkpoints don't record a movie position, so playback would start
+  // over from its first frame on top of the resumed state.
+  if (resume_file && movie_file) {
+    printf("--resume can't be combined with --movie\n");
+    return 1;
+  }
+  if (usage || !rom_file) {
+    printf("Usage: %s [--frames=N] [--movie=file] [--no-audio] [--fast-boot] "
+           "[--info] [--no-gamedb] [--format=argb8888|rgb565|bgr555] "
+           "[--checkpoint=file] [--resume=file] <rom_file> [bios_file]\n",
+           argv[0]);
+    return 1;
+  }
+
+  Gba *gba = malloc(sizeof(Gba));
+  if (!gba_init(gba, bios_file, rom_file)) {
+    gba_free(gba);
+    free(gba);
+    return 1;
+  }
+  // A movie starts from its own state, booted or not.
+  if (fast_boot) {
+    gba_skip_bios(gba);
+  }
+  ppu_set_format(gba, format);
+
+  if (info) {
+    RomInfo *rom_info = &gba->rom.info;
+    printf("title %s code %s crc %08x save type %d swi mask %08x",
+           gba->rom.title, gba->rom.code, rom_info->crc, rom_info->save_type,
+           rom_info->swi_mask);
+    if (rom_info->idle_loop) {
+      printf(" idle loop %08x", rom_info->idle_loop);
+    }
+    if (rom_info->has_waitcnt) {
+      printf(" waitcnt %04x", rom_info->waitcnt);
+    }
+    printf("\n");
+  }
+
+  Movie movie;
+  bool playing = false;
+  if (movie_file) {
+    if (!movie_load(&movie, movie_file) || !movie_play_start(&movie, gba)) {
+      gba_free(gba);
+      free(gba);
+      return 1;
+    }
+    playing = true;
+    if (frames < 0) {
+      frames = movie.frame_count;
+    }
+  }
+  if (frames < 0) {
+    frames = DEFAULT_FRAMES;
+  }
+  // Resuming continues the frame count the checkpoints are tagged with.
+  u64 first_frame = 0;
+  if (resume_file && !checkpoint_restore(gba, resume_file, -1, &first_frame)) {
+    if (playing) {
+      movie_free(&movie);
+    }
+    gba_free(gba);
+    free(gba);
+    return 1;
+  }
+  Checkpoint checkpoint;
+  bool checkpointing = checkpoint_file &&
+                       checkpoint_open(&checkpoint, gba, checkpoint_file,
+                                       CHECKPOINT_INTERVAL,
+                                       CHECKPOINT_FULL_INTERVAL,
+                                       CHECKPOINT_MAX_BYTES);
+  apu_set_synthesize(gba, audio);
+
+  double start = now_seconds();
+  long frame = 0;
+  u64 samples = 0;
+  for (; frame < frames; frame++) {
+    if (playing && !movie_play_frame(&movie, gba)) {
+      break;
+    }
+    gba_run_frame(gba);
+
+    apu_sync(gba);
+    s16 buffer[APU_BUFFER_SIZE * 2];
+    samples += apu_read_samples(gba, buffer, APU_BUFFER_SIZE);
+    if (checkpointing) {
+      checkpoint_capture(&checkpoint, gba, first_frame + frame + 1);
+    }
+  }
+  double elapsed = now_seconds() - start;
+
+  u32 frame_crc = crc32(0, (const u8 *)gba->ppu.framebuffer,
+                        PIXELS_WIDTH * PIXELS_HEIGHT *
+                            ppu_bytes_per_pixel(format));
+  printf("frames %ld time %.3f s fps %.1f samples %llu frame crc %08x\n",
+         frame, elapsed, frame / MAX(elapsed, 1e-9),
+         (unsigned long long)samples, frame_crc);
+
+  if (checkpointing) {
+    checkpoint_close(&checkpoint);
+  }
+  if (playing) {
+    movie_free(&movie);
+  }
+  gba_free(gba);
+  free(gba);
+  return 0;
+}
@@ -0,0 +1,294 @@
+#include "common.h"
+#include "crc32.h"
+#include "gba.h"
+#include "movie.h"
+#include "rominfo.h"
+#include "util.h"
+#include <stddef.h>
+#include <string.h>
+
+// Replays a corpus of ROMs, with or without input movies, hashing each
+// subsystem's state after every frame and comparing against golden hashes
+// recorded with --update. Any change to what the emulator computes shows up
+// as the first frame and subsystem that differ, which is what a fast path
+// has to be checked against. The game database is ignored so results don't
+// depend on the user's files.
+//
+// The manifest has one job per line, paths relative to the manifest:
+//
+//   <rom> <movie or -> <golden file> [frames]
+//
+// Blank lines and lines starting with '#' are ignored. Without a movie the
+// frame count is required and the ROM runs from power-on with no input.
+//
+// Golden files hold "GBAHASHS", u32 version, u32 subsystem count, u32
+// frame count, then one CRC-32 per subsystem per frame, little-endian.
+
+#define GOLDEN_MAGIC "GBAHASHS"
+#define GOLDEN_MAGIC_SIZE 8
+#define GOLDEN_VERSION 1
+#define GOLDEN_HEADER_SIZE (GOLDEN_MAGIC_SIZE + 12)
+
+typedef struct {
+  const char *name;
+  size_t offset;
+  size_t size;
+} Subsystem;
+
+// Internal bookkeeping that fast paths may legitimately do differently,
+// like the scheduler queue or the palette cache, is left out.
+static const Subsystem subsystems[] = {
+    {"frame", offsetof(Gba, ppu.framebuffer), sizeof(((Ppu *)0)->framebuffer)},
+    {"cpu", offsetof(Gba, cpu), sizeof(Cpu)},
+    {"ewram", offsetof(Gba, ewram), sizeof(((Gba *)0)->ewram)},
+    {"iwram", offsetof(Gba, iwram), sizeof(((Gba *)0)->iwram)},
+    {"palram", offsetof(Gba, ppu.palram), sizeof(((Ppu *)0)->palram)},
+    {"vram", offsetof(Gba, ppu.vram), sizeof(((Ppu *)0)->vram)},
+    {"oam", offsetof(Gba, ppu.oam), sizeof(((Ppu *)0)->oam)},
+    {"io", offsetof(Gba, io), sizeof(Io)},
+    {"dma", offsetof(Gba, dma), sizeof(Dma)},
+    {"timers", offsetof(Gba, tmr_mgr), sizeof(TimerManager)},
+    {"apu", offsetof(Gba, apu), sizeof(Apu)},
+    {"backup", offsetof(Gba, backup), sizeof(Backup)},
+};
+
+#define NUM_SUBSYSTEMS (sizeof(subsystems) / sizeof(subsystems[0]))
+
+static void hash_frame(Gba *gba, u32 *out) {
+  for (size_t i = 0; i < NUM_SUBSYSTEMS; i++) {
+    out[i] = crc32(0, (const u8 *)gba + subsystems[i].offset,
+                   subsystems[i].size);
+  }
+}
+
+// Returns the hashes of every frame, or NULL if the job couldn't run.
+static u32 *run_job(const char *bios, const char *rom, const char *movie_path,
+                    u32 *frames) {
+  Gba *gba = malloc(sizeof(Gba));
+  if (!gba_init(gba, bios, rom)) {
+    gba_free(gba);
+    free(gba);
+    return NULL;
+  }
+
+  Movie movie;
+  bool playing = movie_path != NULL;
+  if (playing) {
+    if (!movie_load(&movie, movie_path)) {
+      gba_free(gba);
+      free(gba);
+      return NULL;
+    }
+    if (!movie_play_start(&movie, gba)) {
+      movie_free(&movie);
+      gba_free(gba);
+      free(gba);
+      return NULL;
+    }
+    if (*frames == 0) {
+      *frames = movie.frame_count;
+    }
+  }
+
+  u32 *hashes = malloc((size_t)MAX(*frames, 1) * NUM_SUBSYSTEMS * sizeof(u32));
+  u32 frame = 0;
+  for (; frame < *frames; frame++) {
+    if (playing && !movie_play_frame(&movie, gba)) {
+      break;
+    }
+    gba_run_frame(gba);
+    // Keep the sample buffer from filling; its contents are hashed anyway.
+    apu_sync(gba);
+    s16 samples[APU_BUFFER_SIZE * 2];
+    apu_read_samples(gba, samples, APU_BUFFER_SIZE);
+    hash_frame(gba, hashes + frame * NUM_SUBSYSTEMS);
+  }
+  *frames = frame;
+
+  if (playing) {
+    movie_free(&movie);
+  }
+  gba_free(gba);
+  free(gba);
+  return hashes;
+}
+
+static bool write_golden(const char *path, const u32 *hashes, u32 frames) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    printf("Failed to open golden file: %s\n", path);
+    return false;
+  }
+  u8 header[GOLDEN_HEADER_SIZE];
+  memcpy(header, GOLDEN_MAGIC, GOLDEN_MAGIC_SIZE);
+  put32(header + GOLDEN_MAGIC_SIZE, GOLDEN_VERSION);
+  put32(header + GOLDEN_MAGIC_SIZE + 4, NUM_SUBSYSTEMS);
+  put32(header + GOLDEN_MAGIC_SIZE + 8, frames);
+  bool ok = fwrite(header, 1, GOLDEN_HEADER_SIZE, file) == GOLDEN_HEADER_SIZE;
+  for (size_t i = 0; ok && i < (size_t)frames * NUM_SUBSYSTEMS; i++) {
+    u8 word[4];
+    put32(word, hashes[i]);
+    ok = fwrite(word, 1, 4, file) == 4;
+  }
+  ok &= fclose(file) == 0;
+  if (!ok) {
+    printf("Failed to write golden file: %s\n", path);
+  }
+  return ok;
+}
+
+static u32 *read_golden(const char *path, u32 *frames) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    printf("Failed to open golden file: %s\n", path);
+    return NULL;
+  }
+  u8 header[GOLDEN_HEADER_SIZE];
+  u32 *hashes = NULL;
+  bool ok = fread(header, 1, GOLDEN_HEADER_SIZE, file) == GOLDEN_HEADER_SIZE &&
+            memcmp(header, GOLDEN_MAGIC, GOLDEN_MAGIC_SIZE) == 0 &&
+            get32(header + GOLDEN_MAGIC_SIZE) == GOLDEN_VERSION &&
+            get32(header + GOLDEN_MAGIC_SIZE + 4) == NUM_SUBSYSTEMS;
+  if (ok) {
+    *frames = get32(header + GOLDEN_MAGIC_SIZE + 8);
+    size_t count = (size_t)*frames * NUM_SUBSYSTEMS;
+    hashes = malloc(MAX(count, 1) * sizeof(u32));
+    for (size_t i = 0; ok && i < count; i++) {
+      u8 word[4];
+      if (fread(word, 1, 4, file) != 4) {
+        ok = false;
+        break;
+      }
+      hashes[i] = get32(word);
+    }
+  }
+  fclose(file);
+  if (!ok) {
+    printf("Corrupt or outdated golden file: %s\n", path);
+    free(hashes);
+    return NULL;
+  }
+  return hashes;
+}
+
+// Reports the first frame that differs and every subsystem that differs
+// in it. Returns true if the runs match.
+static bool compare(const char *name, const u32 *actual, u32 actual_frames,
+                    const u32 *golden, u32 golden_frames) {
+  u32 frames = MIN(actual_frames, golden_frames);
+  for (u32 frame = 0; frame < frames; frame++) {
+    const u32 *a = actual + frame * NUM_SUBSYSTEMS;
+    const u32 *g = golden + frame * NUM_SUBSYSTEMS;
+    if (memcmp(a, g, NUM_SUBSYSTEMS * sizeof(u32)) == 0) {
+      continue;
+    }
+    printf("FAIL %s: frame %u differs in", name, frame);
+    for (size_t i = 0; i < NUM_SUBSYSTEMS; i++) {
+      if (a[i] != g[i]) {
+        printf(" %s", subsystems[i].name);
+      }
+    }
+    printf("\n");
+    return false;
+  }
+  if (actual_frames != golden_frames) {
+    printf("FAIL %s: ran %u frames, golden has %u\n", name, actual_frames,
+           golden_frames);
+    return false;
+  }
+  printf("PASS %s (%u frames)\n", name, frames);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  char *manifest_file = NULL;
+  char *bios_file = "gba_bios.bin";
+  bool update = false;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--bios=", 7) == 0) {
+      bios_file = argv[i] + 7;
+    } else if (strcmp(argv[i], "--update") == 0) {
+      update = true;
+    } else if (argv[i][0] == '-' || manifest_file) {
+      usage = true;
+    } else {
+      manifest_file = argv[i];
+    }
+  }
+  if (usage || !manifest_file) {
+    printf("Usage: %s [--bios=file] [--update] <manifest>\n", argv[0]);
+    return 2;
+  }
+  rominfo_use_database(false);
+
+  FILE *manifest = fopen(manifest_file, "r");
+  if (!manifest) {
+    printf("Failed to open manifest: %s\n", manifest_file);
+    return 2;
+  }
+
+  char dir[4096];
+  snprintf(dir, sizeof(dir), "%s", manifest_file);
+  char *slash = strrchr(dir, '/');
+  if (slash) {
+    *slash = '\0';
+  } else {
+    dir[0] = '\0';
+  }
+
+  int jobs = 0;
+  int failed = 0;
+  char line[4096];
+  for (int line_number = 1; fgets(line, sizeof(line), manifest);
+       line_number++) {
+    char rom_name[1024], movie_name[1024], golden_name[1024];
+    u32 frames = 0;
+    int fields = sscanf(line, "%1023s %1023s %1023s %u", rom_name, movie_name,
+                        golden_name, &frames);
+    if (fields <= 0 || rom_name[0] == '#') {
+      continue;
+    }
+    bool has_movie = strcmp(movie_name, "-") != 0;
+    if (fields < 3 || (!has_movie && frames == 0)) {
+      printf("%s:%d: expected <rom> <movie or -> <golden> [frames]\n",
+             manifest_file, line_number);
+      failed++;
+      continue;
+    }
+
+    char rom[4096], movie[4096], golden[4096];
+    resolve(rom, sizeof(rom), dir, rom_name);
+    resolve(movie, sizeof(movie), dir, movie_name);
+    resolve(golden, sizeof(golden), dir, golden_name);
+    jobs++;
+
+    u32 *hashes = run_job(bios_file, rom, has_movie ? movie : NULL, &frames);
+    if (!hashes) {
+      printf("FAIL %s: couldn't run\n", golden_name);
+      failed++;
+      continue;
+    }
+
+    if (update) {
+      if (write_golden(golden, hashes, frames)) {
+        printf("WROTE %s (%u frames)\n", golden_name, frames);
+      } else {
+        failed++;
+      }
+    } else {
+      u32 golden_frames;
+      u32 *expected = read_golden(golden, &golden_frames);
+      if (!expected ||
+          !compare(golden_name, hashes, frames, expected, golden_frames)) {
+        failed++;
+      }
+      free(expected);
+    }
+    free(hashes);
+  }
+  fclose(manifest);
+
+  printf("%d of %d jobs failed\n", failed, jobs);
+  return failed > 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "common.h"
+#include <time.h>
+
+// Helpers shared by the command line tools.
+
+static inline double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Paths in a manifest are relative to the manifest's directory.
+static inline void resolve(char *out, size_t size, const char *dir,
+                           const char *path) {
+  if (path[0] == '/' || dir[0] == '\0') {
+    snprintf(out, size, "%s", path);
+  } else {
+    snprintf(out, size, "%s/%s", dir, path);
+  }
+}
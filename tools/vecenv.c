@@ -0,0 +1,128 @@
+#include "common.h"
+#include "crc32.h"
+#include "gba.h"
+#include "util.h"
+#include "vecenv.h"
+#include <string.h>
+
+// Measures a batch of environments stepped with random input, the way a
+// training loop drives them. Boots the ROM, optionally runs it for a while
+// so episodes start in the game, then steps the batch. The input comes from
+// a fixed seed, so the final CRC over every observation and RAM view is the
+// same on every run regardless of the thread count.
+
+#define DEFAULT_ENVS 16
+#define DEFAULT_STEPS 1000
+#define DEFAULT_FRAMES_PER_STEP 4
+
+static u32 xorshift(u32 *state) {
+  u32 x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+int main(int argc, char *argv[]) {
+  char *rom_file = NULL;
+  char *bios_file = "gba_bios.bin";
+  int envs = DEFAULT_ENVS;
+  int threads = 0;
+  int steps = DEFAULT_STEPS;
+  int frames_per_step = DEFAULT_FRAMES_PER_STEP;
+  int episode = 0;
+  int warmup = 0;
+  bool fast_boot = false;
+  int positional = 0;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--envs=", 7) == 0) {
+      envs = atoi(argv[i] + 7);
+      usage |= envs <= 0;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      threads = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--steps=", 8) == 0) {
+      steps = atoi(argv[i] + 8);
+      usage |= steps <= 0;
+    } else if (strncmp(argv[i], "--frames-per-step=", 18) == 0) {
+      frames_per_step = atoi(argv[i] + 18);
+      usage |= frames_per_step <= 0;
+    } else if (strncmp(argv[i], "--episode=", 10) == 0) {
+      episode = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--warmup=", 9) == 0) {
+      warmup = atoi(argv[i] + 9);
+    } else if (strcmp(argv[i], "--fast-boot") == 0) {
+      fast_boot = true;
+    } else if (argv[i][0] == '-') {
+      usage = true;
+    } else if (positional == 0) {
+      rom_file = argv[i];
+      positional++;
+    } else if (positional == 1) {
+      bios_file = argv[i];
+      positional++;
+    } else {
+      usage = true;
+    }
+  }
+  if (usage || !rom_file) {
+    printf("Usage: %s [--envs=N] [--threads=N] [--steps=N] "
+           "[--frames-per-step=N] [--episode=frames] [--warmup=frames] "
+           "[--fast-boot] <rom_file> [bios_file]\n",
+           argv[0]);
+    return 1;
+  }
+
+  Gba *gba = malloc(sizeof(Gba));
+  if (!gba_init(gba, bios_file, rom_file)) {
+    gba_free(gba);
+    free(gba);
+    return 1;
+  }
+  if (fast_boot) {
+    gba_skip_bios(gba);
+  }
+  apu_set_synthesize(gba, false);
+  for (int i = 0; i < warmup; i++) {
+    gba_run_frame(gba);
+  }
+
+  VecEnv env;
+  if (!vecenv_init(&env, gba, envs, threads)) {
+    gba_free(gba);
+    free(gba);
+    return 1;
+  }
+  env.max_frames = episode;
+
+  u16 *actions = malloc(envs * sizeof(u16));
+  u32 seed = 0x2545F491;
+  u32 episodes = 0;
+  double start = now_seconds();
+  for (int step = 0; step < steps; step++) {
+    for (int i = 0; i < envs; i++) {
+      // One button at a time, or none, held for the whole step.
+      u32 button = xorshift(&seed) % 11;
+      actions[i] = button < 10 ? 0x3FF & ~(1 << button) : 0x3FF;
+    }
+    vecenv_step(&env, actions, frames_per_step);
+    for (int i = 0; i < envs; i++) {
+      episodes += env.done[i];
+    }
+  }
+  double elapsed = now_seconds() - start;
+
+  u32 crc = crc32(0, env.observations, envs * env.observation_size);
+  crc = crc32(crc, env.ram, (size_t)envs * VECENV_RAM_SIZE);
+  u64 frames = (u64)steps * envs * frames_per_step;
+  printf("envs %d threads %d steps %d episodes %u time %.3f s steps/s %.1f "
+         "fps %.1f crc %08x\n",
+         envs, env.pool.num_workers, steps, episodes, elapsed,
+         steps / MAX(elapsed, 1e-9), frames / MAX(elapsed, 1e-9), crc);
+
+  free(actions);
+  vecenv_free(&env);
+  gba_free(gba);
+  free(gba);
+  return 0;
+}